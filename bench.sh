@@ -0,0 +1,131 @@
+#!/bin/sh
+#
+# Benchmarks transfers between the server and the client over loopback. Every
+# combination of the settings below is run once with a freshly generated file,
+# and one row of results is printed per run, as CSV or JSON.
+# The settings are taken from the environment, with the defaults in brackets:
+#
+#   BENCH_SIZES          file sizes, with an optional K or M suffix   [1M 8M]
+#   BENCH_DROP_RATES     percentages of packets dropped by the server [0 10]
+#   BENCH_CHANNELS       no. of channels                              [1 4]
+#   BENCH_PACKET_SIZES   payload bytes per packet                     [1400 8192]
+#   BENCH_TIMEOUTS       initial retransmission timeouts in ms        [200]
+#   BENCH_COMPRESS       off, or on to compress the packets           [off]
+#   BENCH_WINDOW         packets in flight per channel                [16]
+#   BENCH_DATA           random, or text repeating input.txt          [random]
+#   BENCH_FORMAT         csv or json                                  [csv]
+#   BENCH_OUTPUT         file the results are written to              [stdout]
+#   BENCH_RUN_TIMEOUT    seconds after which a run is given up        [300]
+#
+# e.g. make bench BENCH_FORMAT=json BENCH_DROP_RATES="0 1 5"
+
+SIZES=${BENCH_SIZES:-"1M 8M"}
+DROP_RATES=${BENCH_DROP_RATES:-"0 10"}
+CHANNELS=${BENCH_CHANNELS:-"1 4"}
+PACKET_SIZES=${BENCH_PACKET_SIZES:-"1400 8192"}
+TIMEOUTS=${BENCH_TIMEOUTS:-"200"}
+COMPRESS=${BENCH_COMPRESS:-off}
+WINDOW=${BENCH_WINDOW:-16}
+DATA=${BENCH_DATA:-random}
+FORMAT=${BENCH_FORMAT:-csv}
+RUN_TIMEOUT=${BENCH_RUN_TIMEOUT:-300}
+
+FIELDS="seconds mb_per_s packets_sent retransmissions failovers ack_p50_ms ack_p90_ms ack_p99_ms ack_max_ms checksum_ms wire_bytes compress_ms"
+
+if [ "$FORMAT" != csv ] && [ "$FORMAT" != json ]; then
+	echo "BENCH_FORMAT must be csv or json" >&2
+	exit 1
+fi
+if [ "$DATA" != random ] && [ "$DATA" != text ]; then
+	echo "BENCH_DATA must be random or text" >&2
+	exit 1
+fi
+cd "$(dirname "$0")" || exit 1
+if [ ! -x ./server ] || [ ! -x ./client ]; then
+	echo "Build the server and the client first" >&2
+	exit 1
+fi
+if [ -n "$BENCH_OUTPUT" ]; then
+	exec > "$BENCH_OUTPUT"
+fi
+
+WORK=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK"' EXIT
+
+# field NAME: value of a field of the summary written by the client
+field() {
+	sed -n "s/.*\"$1\": \([^,}]*\).*/\1/p" "$WORK/summary.json"
+}
+
+# generate SIZE: writes the input file of the runs
+generate() {
+	if [ "$DATA" = random ]; then
+		head -c "$1" /dev/urandom
+	else
+		while cat input.txt 2> /dev/null; do :; done | head -c "$1"
+	fi > "$WORK/input"
+}
+
+# run SIZE DROP_RATE CHANNELS PACKET_SIZE TIMEOUT COMPRESS: one transfer, prints its row
+run() {
+	rm -rf "$WORK/out" "$WORK/summary.json"
+	mkdir "$WORK/out"
+	compress_opt=
+	[ "$6" = on ] && compress_opt=-z
+	./server -d "$WORK/out" -l "$2" > /dev/null 2>&1 &
+	server=$!
+	sleep 0.3
+	timeout "$RUN_TIMEOUT" ./client -c "$3" -w "$WINDOW" -s "$4" -t "$5" -o bench.out -j "$WORK/summary.json" \
+		$compress_opt "$WORK/input" > /dev/null 2>&1
+	completed=false
+	if [ -f "$WORK/summary.json" ] && cmp -s "$WORK/input" "$WORK/out/bench.out"; then
+		completed=true
+	fi
+	kill "$server" 2> /dev/null
+	wait "$server" 2> /dev/null
+
+	bytes=$(wc -c < "$WORK/input" | tr -d ' ')
+	if [ "$FORMAT" = csv ]; then
+		row="$bytes,$2,$3,$WINDOW,$4,$5,$6,$completed"
+		for f in $FIELDS; do
+			row="$row,$([ $completed = true ] && field "$f")"
+		done
+		echo "$row"
+	else
+		[ "$rows" -gt 0 ] && echo ","
+		printf '  {"bytes": %s, "drop_rate": %s, "channels": %s, "window": %s, "packet_size": %s, "timeout_ms": %s, "compress": "%s", "completed": %s' \
+			"$bytes" "$2" "$3" "$WINDOW" "$4" "$5" "$6" "$completed"
+		if [ $completed = true ]; then
+			for f in $FIELDS; do
+				printf ', "%s": %s' "$f" "$(field "$f")"
+			done
+		fi
+		printf '}'
+	fi
+	rows=$((rows + 1))
+}
+
+rows=0
+if [ "$FORMAT" = csv ]; then
+	echo "bytes,drop_rate,channels,window,packet_size,timeout_ms,compress,completed,$(echo $FIELDS | tr ' ' ',')"
+else
+	echo "["
+fi
+for size in $SIZES; do
+	generate "$size" || exit 1
+	for drop_rate in $DROP_RATES; do
+		for channels in $CHANNELS; do
+			for packet_size in $PACKET_SIZES; do
+				for timeout_ms in $TIMEOUTS; do
+					for compress in $COMPRESS; do
+						run "$size" "$drop_rate" "$channels" "$packet_size" "$timeout_ms" "$compress"
+					done
+				done
+			done
+		done
+	done
+done
+if [ "$FORMAT" = json ]; then
+	echo
+	echo "]"
+fi
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "checkpoint.h"
+
+/**
+ * Reads a part of a file, completing short reads
+ * @param fd		The file
+ * @param buf		The destination
+ * @param len		The no. of bytes to read
+ * @param offset	The file offset
+ *
+ * @return 0 on success, -1 on failure or if the file ends before
+ */
+static int read_fully(int fd, void* buf, size_t len, uint64_t offset) {
+	char* dst = buf;
+	while(len > 0) {
+		ssize_t n = pread(fd, dst, len, offset);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			return -1;
+		}
+		dst += n;
+		len -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+/**
+ * Writes a part of a file, completing short writes
+ * @param fd		The file
+ * @param buf		The source
+ * @param len		The no. of bytes to write
+ * @param offset	The file offset
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int write_fully(int fd, const void* buf, size_t len, uint64_t offset) {
+	const char* src = buf;
+	while(len > 0) {
+		ssize_t n = pwrite(fd, src, len, offset);
+		if(n < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		src += n;
+		len -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+/**
+ * Rewrites the header of an open checkpoint
+ * @param cp	The checkpoint
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int write_header(Checkpoint* cp) {
+	uint64_t header[CHECKPOINT_HEADER_SIZE / sizeof(uint64_t)] = { CHECKPOINT_MAGIC, cp->file_id, cp->stream_size,
+		cp->manifest_size, cp->next_seq, cp->digest };
+	return write_fully(cp->fd, header, sizeof(header), 0);
+}
+
+/**
+ * Reads the header of the checkpoint of an earlier transfer
+ * @param cp	Output, the checkpoint, not kept open
+ * @param path	The path of the sidecar file
+ *
+ * @return 0 on success, -1 if there is no valid checkpoint
+ */
+int checkpoint_load(Checkpoint* cp, const char* path) {
+	memset(cp, 0, sizeof(Checkpoint));
+	cp->fd = -1;
+	snprintf(cp->path, sizeof(cp->path), "%s", path);
+
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		return -1;
+	}
+	uint64_t header[CHECKPOINT_HEADER_SIZE / sizeof(uint64_t)];
+	struct stat st;
+	if(read_fully(fd, header, sizeof(header), 0) < 0 || header[0] != CHECKPOINT_MAGIC || fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	cp->file_id = header[1];
+	cp->stream_size = header[2];
+	cp->manifest_size = header[3];
+	cp->next_seq = header[4];
+	cp->digest = header[5];
+	cp->has_manifest = cp->manifest_size > 0 && (uint64_t) st.st_size >= CHECKPOINT_HEADER_SIZE + cp->manifest_size;
+	if(cp->next_seq > cp->stream_size) {
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Reads the manifest saved with the checkpoint of a tree
+ * @param cp		The checkpoint, as loaded
+ * @param manifest	Output, manifest_size bytes
+ *
+ * @return 0 on success, -1 on failure
+ */
+int checkpoint_load_manifest(Checkpoint* cp, unsigned char* manifest) {
+	int fd = open(cp->path, O_RDONLY);
+	if(fd < 0) {
+		return -1;
+	}
+	int status = read_fully(fd, manifest, cp->manifest_size, CHECKPOINT_HEADER_SIZE);
+	close(fd);
+	return status;
+}
+
+/**
+ * Starts keeping the checkpoints of a transfer. A transfer from the start
+ * replaces any earlier checkpoint, a resumed one continues its own.
+ * @param cp			The checkpoint
+ * @param path			The path of the sidecar file
+ * @param file_id		The version of the input
+ * @param stream_size	The no. of bytes of the stream
+ * @param manifest_size	The no. of bytes of the manifest of a tree, 0 for a
+ * 						single file
+ * @param next_seq		The offset the transfer starts at
+ * @param digest		The CRC32C of the stream before next_seq
+ *
+ * @return 0 on success, -1 on failure
+ */
+int checkpoint_open(Checkpoint* cp, const char* path, uint64_t file_id, uint64_t stream_size, uint64_t manifest_size,
+	uint64_t next_seq, uint32_t digest) {
+	memset(cp, 0, sizeof(Checkpoint));
+	snprintf(cp->path, sizeof(cp->path), "%s", path);
+	cp->file_id = file_id;
+	cp->stream_size = stream_size;
+	cp->manifest_size = manifest_size;
+	cp->next_seq = next_seq;
+	cp->digest = digest;
+
+	/* a tree is only resumed with its manifest saved */
+	cp->has_manifest = (next_seq > 0 && manifest_size > 0);
+	cp->fd = open(path, O_RDWR | O_CREAT | (next_seq == 0 ? O_TRUNC : 0), 0666);
+	if(cp->fd < 0) {
+		return -1;
+	}
+	if(write_header(cp) < 0) {
+		checkpoint_close(cp);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Saves the progress of a transfer. The caller must have handed the stream
+ * up to next_seq to the kernel.
+ * @param cp		The checkpoint
+ * @param next_seq	The offset up to which the stream has been written
+ * @param digest	The CRC32C of the stream before next_seq
+ * @param manifest	The manifest of a tree, NULL if it has not been received
+ * 					completely yet
+ *
+ * @return 0 on success, -1 on failure
+ */
+int checkpoint_save(Checkpoint* cp, uint64_t next_seq, uint32_t digest, const unsigned char* manifest) {
+	if(cp->fd < 0) {
+		return 0;
+	}
+	if(cp->manifest_size > 0 && !cp->has_manifest) {
+		if(manifest == NULL) {
+			/* a tree cannot be resumed without its manifest */
+			next_seq = 0;
+			digest = 0;
+		} else if(write_fully(cp->fd, manifest, cp->manifest_size, CHECKPOINT_HEADER_SIZE) < 0) {
+			return -1;
+		} else {
+			cp->has_manifest = 1;
+		}
+	}
+	cp->next_seq = next_seq;
+	cp->digest = digest;
+	return write_header(cp);
+}
+
+/**
+ * Stops keeping the checkpoints of a transfer, the last one is kept
+ * @param cp	The checkpoint
+ */
+void checkpoint_close(Checkpoint* cp) {
+	if(cp->fd >= 0) {
+		close(cp->fd);
+		cp->fd = -1;
+	}
+}
+
+/**
+ * Deletes the checkpoints of a completed transfer
+ * @param cp	The checkpoint
+ */
+void checkpoint_remove(Checkpoint* cp) {
+	if(cp->fd >= 0) {
+		checkpoint_close(cp);
+		unlink(cp->path);
+	}
+}
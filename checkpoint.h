@@ -0,0 +1,44 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <limits.h>
+
+#define CHECKPOINT_MAGIC 0x54435043484b5032ULL /* "TCPCHKP2" */
+#define CHECKPOINT_HEADER_SIZE 48
+#define CHECKPOINT_INTERVAL_MS 1000 /* period of the checkpoints of a running session */
+
+/*
+ * Progress of a transfer kept in a sidecar file next to its destination, so
+ * that an interrupted transfer of the same input can be resumed. The file
+ * holds a header, rewritten in place by every checkpoint, followed by the
+ * manifest of a tree once it has been received. The header is
+ *
+ *   0          8          16            24              32         40         48
+ *   +----------+----------+-------------+---------------+----------+----------+
+ *   |  magic   | file_id  | stream_size | manifest_size | next_seq |  digest  |
+ *   +----------+----------+-------------+---------------+----------+----------+
+ *
+ * in host byte order, where next_seq is the offset up to which the stream has
+ * been handed to the kernel and digest the CRC32C of the stream before it.
+ */
+typedef struct checkpoint {
+	int fd; /* of the sidecar file, -1 if it is not open */
+	char path[PATH_MAX];
+	uint64_t file_id;
+	uint64_t stream_size;
+	uint64_t manifest_size; /* 0 for a single file */
+	uint64_t next_seq; /* as saved last */
+	uint32_t digest; /* CRC32C of the stream before next_seq */
+	int has_manifest; /* the manifest of the tree follows the header */
+} Checkpoint;
+
+int checkpoint_load(Checkpoint* cp, const char* path);
+int checkpoint_load_manifest(Checkpoint* cp, unsigned char* manifest);
+int checkpoint_open(Checkpoint* cp, const char* path, uint64_t file_id, uint64_t stream_size, uint64_t manifest_size,
+	uint64_t next_seq, uint32_t digest);
+int checkpoint_save(Checkpoint* cp, uint64_t next_seq, uint32_t digest, const unsigned char* manifest);
+void checkpoint_close(Checkpoint* cp);
+void checkpoint_remove(Checkpoint* cp);
+
+#endif
@@ -4,12 +4,38 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
-#include <sys/select.h>
 #include <errno.h>
 #include <time.h>
+#include <inttypes.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/random.h>
 
 #include "commons.h"
+#include "protocol.h"
+#include "eventloop.h"
+#include "conn.h"
+#include "timer.h"
+#include "source.h"
+#include "impair.h"
+#include "crc32c.h"
+#include "compress.h"
+#include "prefetch.h"
+#include "pool.h"
+
+#define RECONNECT_DELAY_MS 100 /* wait before replacing a broken channel, doubled with every failed attempt */
+#define MAX_RECONNECTS 6 /* failed attempts after which a broken channel is given up */
+#define MAX_LOSS_RATE 0.9 /* cap of the loss estimate of a channel, keeps its expected delivery time finite */
+#define HOLD_MARGIN 1.25 /* a packet waits for a full channel if it would arrive this much sooner on it */
+#define MIN_COMPRESSION_SAVING 16 /* a packet is sent compressed if that saves at least 1/16 of it */
+#define MAX_COMPRESSION_BYPASS 64 /* most packets sent without trying to compress them after one did not shrink */
+
+/* states of a channel */
+#define CH_OPEN 0 /* sending */
+#define CH_CONNECTING 1 /* replacement connection being established */
+#define CH_JOINING 2 /* replacement connection waiting for the server to accept it */
+#define CH_DOWN 3 /* broken, waiting to be replaced */
+#define CH_DEAD 4 /* broken, given up */
 
 /**
  * Function to report an error and terminate the program
@@ -18,28 +44,128 @@
 void report_error(char* str) {
 	perror(str);
 	printf("Terminating program\n");
-	exit(0);
+	exit(1);
 }
 
+struct channel;
+
+/* State of a single packet slot of a channel's window */
+typedef struct slot {
+	/*
+	 * used to maintain state of the slot's packet:
+	 * 0 -> free, send new packet
+	 * 1 -> wait for ACK or Timeout, act accordingly
+	 */
+	int state;
+
+	int trans_count; /* no. of transmissions of the current packet */
+	uint64_t sent_usec; /* monotonic time of the latest transmission */
+	uint64_t first_sent_usec; /* monotonic time of the first transmission */
+	Timer timer; /* retransmission timer of the packet in flight */
+	struct channel* channel; /* the channel owning the slot */
+
+	Packet pkt; /* the packet in flight, its payload points into the stream */
+	int buf; /* pool buffer holding the payload instead, POOL_NONE if none */
+} Slot;
+
+struct sender;
+
+/* State of a single channel of the transfer */
+typedef struct channel {
+	Connection conn; /* connection used by the channel */
+	EventSource src; /* registration of the connection with the event loop */
+	int channel_no;
+	int state; /* CH_OPEN, ..., CH_DEAD */
+	int reconnects; /* failed attempts to replace the channel since it was last open */
+	Timer reconnect_timer;
+	Impairer impair; /* simulated link the received acknowledgements go through */
+	Slot* slots; /* window of packets in flight on the channel */
+	struct sender* sender; /* the transfer the channel belongs to */
+
+	/* RTT estimation (RFC 6298), all in micro-seconds */
+	int has_rtt_sample;
+	uint64_t srtt; /* smoothed round trip time */
+	uint64_t rttvar; /* round trip time variation */
+	uint64_t rto; /* current retransmission timeout */
+
+	/* delivery estimates used by the scheduler */
+	uint64_t progress_usec; /* monotonic time the channel last delivered, or since which it has had packets in flight */
+	int num_in_flight; /* slots holding a packet */
+	uint64_t bytes_in_flight;
+	double loss_rate; /* moving average of the share of acknowledged packets that needed retransmissions */
+	double delivery_rate; /* bytes acknowledged per micro-second, 0 until measured */
+	uint64_t rate_start_usec; /* start of the current delivery rate sample */
+	uint64_t delivered; /* bytes acknowledged since the start of the sample */
+
+	/* statistics */
+	int pkts_sent; /* transmissions, incl. retransmissions */
+	int retransmissions;
+	int failovers; /* times the channel broke and its packets moved to the others */
+} Channel;
+
+/* A packet in flight on a broken channel, to be sent again on another one */
+typedef struct orphan {
+	Packet pkt;
+	int buf; /* pool buffer holding the payload, if any, referenced by the orphan */
+} Orphan;
+
+/* State of the file or tree being sent */
+typedef struct sender {
+	Source src; /* contents of the stream */
+	Prefetcher prefetch; /* reads and checksums the stream ahead of next_seq */
+	BufferPool buffers; /* payloads that do not point into the stream: copies spanning segments, compressed data */
+	size_t file_size; /* bytes of the stream */
+	size_t next_seq; /* offset of the next packet to be generated */
+	int is_file_done; /* set once the last packet has been generated */
+	int is_last_ackd;
+	int window; /* no. of slots per channel */
+	int num_channels;
+	uint32_t packet_size; /* payload bytes per packet, as negotiated */
+	Channel* channels;
+	TimerWheel timers; /* retransmission and reconnection timers */
+	EventLoop* loop;
+	const ImpairConfig* impair; /* impairments of the received acknowledgements, per channel no. */
+	uint64_t session_id;
+	unsigned char hello[MAX_HELLO_SIZE]; /* HELLO proposed at the start, sent again by replacement channels */
+	uint32_t hello_size;
+	uint64_t cum_ack; /* highest cumulative acknowledgement received */
+	uint32_t digest; /* CRC32C of the stream before next_seq */
+	uint32_t shift; /* crc32c_shift() of a full packet */
+	uint32_t server_digest; /* CRC32C of the stream as received by the server, from the final ACK */
+	uint64_t checksum_usec; /* time spent computing checksums of packets not read ahead */
+
+	Compressor* compressor; /* NULL unless packets are compressed */
+	int bypass; /* packets still to be sent without trying to compress them */
+	int backoff; /* packets bypassed after the next one that does not shrink */
+	uint64_t raw_bytes; /* bytes of the stream in the packets sent */
+	uint64_t wire_bytes; /* payload bytes of the packets as first sent */
+	unsigned long num_packets;
+	unsigned long num_compressed;
+	uint64_t compress_usec; /* time spent compressing */
+
+	Orphan* orphans; /* packets of broken channels not sent again yet */
+	int num_orphans;
+
+	uint32_t* latencies; /* micro-seconds from the first transmission of every packet to its ACK */
+	size_t num_latencies;
+	size_t latency_capacity;
+
+	int verbosity; /* VERBOSITY_QUIET, ... */
+	TraceRing* trace; /* trace of the packets, NULL unless a trace file is written */
+	Histogram rtt_histogram; /* RTT samples of all the channels, in micro-seconds */
+	Timer stats_timer; /* prints the progress periodically */
+	uint64_t start_usec; /* monotonic time the transfer started */
+} Sender;
+
 /**
- * Returns the channel on which the timeout is smallest
- * @param c0_sec	The total seconds left for channel 0 to timeout
- * @param c0_usec	The total micro-seconds left for channel 0 to timeout
- * @param c1_sec	The total seconds left for channel 1 to timeout
- * @param c1_usec	The total micro-seconds left for channel 1 to timeout
- * 
- * @return	The channel number (0 or 1) which has smallest timeout left
+ * Fills in the address of the server
+ * @param addr	Output, the address
  */
-int min_time_channel(size_t c0_sec, size_t c0_usec, size_t c1_sec, size_t c1_usec) {
-	size_t c0_time = c0_sec * CLOCKS_PER_SEC + c0_usec;
-	size_t c1_time = c1_sec * CLOCKS_PER_SEC + c1_usec;
-	if(c0_time < c1_time) {
-		return 0;
-	} else if(c0_time > c1_time) {
-		return 1;
-	} else {
-		return rand()%2; /* since both are same, return any one */
-	}
+void server_address(struct sockaddr_in* addr) {
+	memset(addr, 0, sizeof(struct sockaddr_in));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = inet_addr(SERVER_IP);
+	addr->sin_port = htons(SERVER_PORT);
 }
 
 /**
@@ -56,15 +182,7 @@ int create_connection() {
 
 	/* Construct server address structure */
 	struct sockaddr_in serv_addr;
-	memset(&serv_addr, 0, sizeof(struct sockaddr_in));
-	serv_addr.sin_family = AF_INET;
-	serv_addr.sin_addr.s_addr = inet_addr(SERVER_IP);
-	serv_addr.sin_port = htons(SERVER_PORT);
-
-	/* Make socket non-blocking */
-	// if(fcntl(sock, F_SETFL, (fcntl(sock, F_GETFL, 0) | O_NONBLOCK)) < 0) {
-	// 	report_error("Could not make socket nonblocking");
-	// }
+	server_address(&serv_addr);
 
 	/* Establish connection */
 	if(connect(sock, (struct sockaddr*) &serv_addr, sizeof(struct sockaddr)) < 0) {
@@ -76,330 +194,1299 @@ int create_connection() {
 }
 
 /**
- * Generates a new packet to be sent to the server
- * @param fptr			The input file pointer
+ * Starts connecting to the server without waiting for the connection to be
+ * established
+ *
+ * @return The non-blocking socket, or -1 on failure
+ */
+int start_connection(void) {
+	int sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if(sock < 0) {
+		return -1;
+	}
+	struct sockaddr_in serv_addr;
+	server_address(&serv_addr);
+	if(make_nonblocking(sock) < 0 ||
+		(connect(sock, (struct sockaddr*) &serv_addr, sizeof(struct sockaddr)) < 0 && errno != EINPROGRESS)) {
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/**
+ * Takes a buffer of the pool for the payload of a new packet. The pool has a
+ * buffer for every packet that can be held at once, so it is never empty.
+ * @param snd	The transfer
+ *
+ * @return The handle of the buffer
+ */
+int acquire_buffer(Sender* snd) {
+	int buf = pool_acquire(&snd->buffers);
+	if(buf == POOL_NONE) {
+		report_error("Ran out of packet buffers");
+	}
+	return buf;
+}
+
+/**
+ * Replaces the payload of a new packet with its compressed form if that
+ * saves enough. Once a packet does not shrink, the packets after it are sent
+ * as they are without trying, twice as many each time up to
+ * MAX_COMPRESSION_BYPASS, so that data that does not compress costs little.
+ * @param snd	The transfer
+ * @param slot	The slot holding the packet, given the buffer of the
+ * 				compressed payload
+ */
+void compress_packet(Sender* snd, Slot* slot) {
+	Packet* pkt = &slot->pkt;
+	if(snd->bypass > 0) {
+		snd->bypass--;
+		return;
+	}
+	int buf = acquire_buffer(snd);
+	uint64_t start = monotonic_usec();
+	uint32_t size = compress_block(snd->compressor, pkt->payload, pkt->payload_size, pool_data(&snd->buffers, buf),
+		pkt->payload_size - pkt->payload_size / MIN_COMPRESSION_SAVING);
+	snd->compress_usec += monotonic_usec() - start;
+	if(size == 0) {
+		pool_release(&snd->buffers, buf);
+		snd->backoff = (snd->backoff == 0) ? 1 : 2 * snd->backoff;
+		if(snd->backoff > MAX_COMPRESSION_BYPASS) {
+			snd->backoff = MAX_COMPRESSION_BYPASS;
+		}
+		snd->bypass = snd->backoff;
+		return;
+	}
+	snd->backoff = 0;
+
+	/* the slot holds the compressed payload instead of the copy of the data, if any */
+	pool_release(&snd->buffers, slot->buf);
+	slot->buf = buf;
+	pkt->payload = pool_data(&snd->buffers, buf);
+	pkt->payload_size = size;
+	pkt->is_compressed = 1;
+	snd->num_compressed++;
+}
+
+/**
+ * Generates a new packet to be sent to the server, in a free slot. The
+ * payload is not copied, it points into the stream, unless it spans two of
+ * its segments.
+ * @param snd			The transfer
+ * @param slot			The slot that will hold the packet
  * @param channel_no	The channel through which the packet
  * 						will be sent
- * 
- * @return A new packet
  */
-Packet create_packet(FILE* fptr, int channel_no) {
-	Packet pkt;
-	pkt.seq_no = ftell(fptr);
-	pkt.payload_size = fread(pkt.payload, 1, PACKET_SIZE, fptr);
-	pkt.channel_no = channel_no;
-	pkt.is_last = ((pkt.payload_size < PACKET_SIZE) ? 1 : 0); /* Last pakcet if less than required no. of bytes read */
-	pkt.data_or_ack = 0; /* client always sends only data pakcets */
-	return pkt;
-}
-
-/**
- * Computes the time left for a channel to timeout. Value-result type implementation,
- * thus values of input parameters will be updated to reflect the results
- * @param sec	The total seconds that were initially left
- * @param usec	The total micro-seconds that were initially left
- */
-void time_left(size_t* sec, size_t* usec, double time_taken) {
-	double remaining_time = *sec + (double) *usec / CLOCKS_PER_SEC;
-	remaining_time -= time_taken;
-	long remaining_sec = (long) remaining_time;
-	long remaining_usec = (long) ((remaining_time - (double) remaining_sec) * CLOCKS_PER_SEC);
-	if(remaining_sec < 0 || remaining_usec < 0) {
-		*sec = 0;
-		*usec = 1; /* force instant timeout at select */
-	} else {
-		*sec = (size_t) remaining_sec;
-		*usec = (size_t) remaining_usec;
+void create_packet(Sender* snd, Slot* slot, int channel_no) {
+	Packet* pkt = &slot->pkt;
+	size_t remaining = snd->file_size - snd->next_seq;
+	pkt->seq_no = snd->next_seq;
+	pkt->payload_size = (remaining < snd->packet_size) ? remaining : snd->packet_size;
+	pkt->payload = (char*) source_read(&snd->src, snd->next_seq, pkt->payload_size, NULL);
+	if(pkt->payload == NULL) {
+		slot->buf = acquire_buffer(snd);
+		pkt->payload = (char*) source_read(&snd->src, snd->next_seq, pkt->payload_size, pool_data(&snd->buffers, slot->buf));
+	}
+	pkt->channel_no = channel_no;
+	pkt->is_last = ((snd->next_seq + pkt->payload_size == snd->file_size) ? 1 : 0); /* Last pakcet if it reaches the end of the file */
+
+	/* checksum the packet once, unless read ahead, retransmissions reuse it, and extend the digest of the stream with it */
+	uint64_t start = monotonic_usec();
+	if(!prefetcher_take(&snd->prefetch, pkt->seq_no, &pkt->checksum)) {
+		pkt->checksum = crc32c(0, pkt->payload, pkt->payload_size);
+	}
+	snd->digest = crc32c_combine(snd->digest, pkt->checksum,
+		(pkt->payload_size == snd->packet_size) ? snd->shift : crc32c_shift(pkt->payload_size));
+	snd->checksum_usec += monotonic_usec() - start;
+	pkt->type = PKT_DATA; /* client always sends only data pakcets */
+	pkt->is_compressed = 0;
+	snd->next_seq += pkt->payload_size;
+	snd->raw_bytes += pkt->payload_size;
+
+	if(snd->compressor != NULL) {
+		compress_packet(snd, slot);
 	}
+	snd->num_packets++;
+	snd->wire_bytes += pkt->payload_size;
 }
 
 /**
- * Prints the trace of a packet ot the console
- * @param pkt	The packet whose trace is to be printed
+ * Records a packet in the trace, and prints it to the console at the
+ * highest verbosity
+ * @param snd	The transfer
+ * @param type	TRACE_SEND, TRACE_RETRANSMIT or TRACE_ACK_RECEIVED
+ * @param pkt	The packet
  */
-void print_packet(Packet* pkt) {
-	switch(pkt->data_or_ack) {
-		case 0: {
+void trace_packet(Sender* snd, int type, Packet* pkt) {
+	uint32_t size = (type == TRACE_ACK_RECEIVED) ? pkt->payload_size / SACK_BLOCK_SIZE : pkt->payload_size;
+	trace_record(snd->trace, type, snd->session_id, pkt->channel_no, pkt->seq_no, size, pkt->is_last);
+	if(snd->verbosity < VERBOSITY_PACKETS) {
+		return;
+	}
+	switch(pkt->type) {
+		case PKT_DATA: {
 			/* data packet sent */
-			printf("SENT PKT: Seq No. %d of size %ld bytes via channel %d\n", pkt->seq_no, pkt->payload_size, pkt->channel_no);
+			printf("SENT PKT: Seq No. %" PRIu64 " of size %" PRIu32 " bytes via channel %d\n", pkt->seq_no, pkt->payload_size, pkt->channel_no);
 		}
 		break;
-		case 1: {
-			/* ack received */
-			printf("RCVD ACK: for PKT with Seq No. %d via channel %d\n", pkt->seq_no, pkt->channel_no);
+		case PKT_ACK: {
+			/* cumulative ack received, along with the ranges received out of order */
+			printf("RCVD ACK: up to Seq No. %" PRIu64 " with %d SACK blocks via channel %d\n", pkt->seq_no,
+				(int) (pkt->payload_size / SACK_BLOCK_SIZE), pkt->channel_no);
 		}
 		break;
 	}
 }
 
-int main() {
-	int fds[2];
-	int max_fd;
-
-	/* Creating the channels for communicating with server */
-	fds[0] = create_connection();
-	fds[1] = create_connection();
-	max_fd = fds[1] + 1;
+/**
+ * Updates the RTT estimate and retransmission timeout of a channel with a new
+ * round trip time measurement, as per RFC 6298
+ * @param ch	The channel
+ * @param rtt	The measured round trip time in micro-seconds
+ */
+void update_rto(Channel* ch, uint64_t rtt) {
+	if(ch->has_rtt_sample == 0) {
+		ch->srtt = rtt;
+		ch->rttvar = rtt / 2;
+		ch->has_rtt_sample = 1;
+	} else {
+		/* RTTVAR <- 3/4 RTTVAR + 1/4 |SRTT - R|, SRTT <- 7/8 SRTT + 1/8 R */
+		uint64_t delta = (ch->srtt > rtt) ? ch->srtt - rtt : rtt - ch->srtt;
+		ch->rttvar = (3 * ch->rttvar + delta) / 4;
+		ch->srtt = (7 * ch->srtt + rtt) / 8;
+	}
 
-	/* opening the file to be read */
-	FILE* fptr = fopen("input.txt", "r");
-	if(fptr == NULL) {
-		report_error("The requested file could not be opened");
+	/* RTO <- SRTT + max(G, 4 * RTTVAR), with the clock granularity G of the timer wheel */
+	uint64_t var = 4 * ch->rttvar;
+	ch->rto = ch->srtt + ((var > TIMER_TICK_USEC) ? var : TIMER_TICK_USEC);
+	if(ch->rto < MIN_RTO_USEC) {
+		ch->rto = MIN_RTO_USEC;
+	} else if(ch->rto > MAX_RTO_USEC) {
+		ch->rto = MAX_RTO_USEC;
 	}
-	fseek(fptr, 0, SEEK_SET);
+}
 
-	clock_t start, end;
+/**
+ * Gets how long a channel may go without delivering anything while it has
+ * packets in flight, before it is assumed to be broken
+ * @param ch	The channel
+ *
+ * @return The time in micro-seconds
+ */
+uint64_t stall_timeout(Channel* ch) {
+	uint64_t timeout = (uint64_t) STALL_TIMEOUT_MS * 1000;
+	if(timeout < STALL_RTOS * ch->rto) {
+		timeout = STALL_RTOS * ch->rto;
+	}
+	return timeout;
+}
 
-	/* used to maintain timer of each packet (one for each channel) */
-	size_t time_left_0_sec = RETRANSMISSION_TIMEOUT;
-	size_t time_left_0_usec = RETRANSMISSION_TIMEOUT;
-	size_t time_left_1_sec = 0;
-	size_t time_left_1_usec = 0;
-	int min_time_sock = 0;
+/**
+ * Sends the packet held in a slot of a channel and restarts its timer
+ * @param ch	The channel on which the packet is to be sent
+ * @param slot	The slot holding the packet
+ */
+void send_slot_packet(Channel* ch, Slot* slot) {
+	if(conn_queue_buffer(&ch->conn, &slot->pkt, &ch->sender->buffers, slot->buf) < 0) {
+		report_error("Failed to queue packet");
+	}
+	if(slot->state == 0) {
+		if(ch->num_in_flight == 0) {
+			/* an idle channel has nothing to deliver, it is only waited for from now on */
+			ch->progress_usec = monotonic_usec();
+		}
+		ch->num_in_flight++;
+		ch->bytes_in_flight += slot->pkt.payload_size;
+	}
+	slot->trans_count++;
+	slot->state = 1;
+	slot->sent_usec = monotonic_usec();
+	if(slot->trans_count == 1) {
+		slot->first_sent_usec = slot->sent_usec;
+	}
+	ch->pkts_sent++;
+	if(slot->trans_count > 1) {
+		ch->retransmissions++;
+	}
 
-	/* used to maintain no. of retransmissions of each packet (-1 = channel closed) */
-	int pkt0_trans_count = 0;
-	int pkt1_trans_count = 0;
+	/* trace the packet */
+	trace_packet(ch->sender, (slot->trans_count > 1) ? TRACE_RETRANSMIT : TRACE_SEND, &slot->pkt);
 
 	/*
-	 * used to maintain state of a packet:
-	 * 0 -> send new packet
-	 * 1 -> wiat for ACK or Timeout, act accordingly
-	 * 2 -> no more packets to transmit on current channel
+	 * restart timer, backing off exponentially with every retransmission, but
+	 * never beyond the time after which the channel is assumed to be broken
 	 */
-	int state_ch0 = 0;
-	int state_ch1 = 0;
+	uint64_t timeout = ch->rto << (slot->trans_count - 1);
+	uint64_t stall = stall_timeout(ch);
+	if(slot->trans_count > 32 || timeout > stall) {
+		timeout = stall;
+	}
+	if(timeout > MAX_RTO_USEC) {
+		timeout = MAX_RTO_USEC;
+	}
+	timer_arm(&ch->sender->timers, &slot->timer, timeout);
+}
 
-	/* generate first packets of each channel */
-	Packet ch0_pkt = create_packet(fptr, 0);
-	Packet ch1_pkt;
+/**
+ * Checks whether the next packet of the file falls within the send window,
+ * i.e. whether the server can buffer it. Packets may not run ahead of the
+ * oldest unacknowledged packet by more than the total window of all channels.
+ * @param snd	The transfer
+ * 
+ * @return 1 if the next packet may be sent, 0 otherwise
+ */
+int is_send_window_open(Sender* snd) {
+	size_t next_seq = snd->next_seq;
+	size_t base = next_seq;
+	for(int i = 0; i < snd->num_orphans; i++) {
+		if(snd->orphans[i].pkt.seq_no < base) {
+			base = snd->orphans[i].pkt.seq_no;
+		}
+	}
+	for(int i = 0; i < snd->num_channels; i++) {
+		for(int j = 0; j < snd->window; j++) {
+			Slot* slot = &snd->channels[i].slots[j];
+			if(slot->state == 1 && slot->pkt.seq_no < base) {
+				base = slot->pkt.seq_no;
+			}
+		}
+	}
+	return next_seq < base + (size_t) snd->num_channels * snd->window * snd->packet_size;
+}
 
-	/* send first packet of each channel */
-	if(send(fds[0], &ch0_pkt, sizeof(Packet), 0) < 0) {
-		report_error("Failed to perform send()");
+/**
+ * Moves the oldest packet of a broken channel that still has to be sent into
+ * a free slot of another channel
+ * @param snd	The transfer
+ * @param slot	The free slot
+ *
+ * @return 1 if the slot holds the packet, 0 if there is none left
+ */
+int adopt_orphan(Sender* snd, Slot* slot) {
+	while(snd->num_orphans > 0) {
+		int oldest = 0;
+		for(int i = 1; i < snd->num_orphans; i++) {
+			if(snd->orphans[i].pkt.seq_no < snd->orphans[oldest].pkt.seq_no) {
+				oldest = i;
+			}
+		}
+		Orphan* orphan = &snd->orphans[oldest];
+		int is_acked = orphan->pkt.payload_size > 0 && orphan->pkt.seq_no + orphan->pkt.payload_size <= snd->cum_ack;
+		if(is_acked) {
+			/* acknowledged on another channel meanwhile */
+			pool_release(&snd->buffers, orphan->buf);
+		} else {
+			/* the slot takes over the reference of the orphan */
+			slot->pkt = orphan->pkt;
+			slot->pkt.channel_no = slot->channel->channel_no;
+			slot->buf = orphan->buf;
+			slot->trans_count = 0;
+		}
+		*orphan = snd->orphans[--snd->num_orphans];
+		if(!is_acked) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Estimates when a packet sent on a channel now would be acknowledged: once
+ * the bytes already in flight on the channel and the packet itself have been
+ * delivered at its delivery rate, plus a round trip, plus a retransmission
+ * timeout for every retransmission its loss rate predicts
+ * @param ch	The channel
+ * @param size	The payload bytes of the packet
+ *
+ * @return The expected time in micro-seconds
+ */
+double expected_delivery(Channel* ch, uint32_t size) {
+	Sender* snd = ch->sender;
+	double rtt = ch->has_rtt_sample ? ch->srtt : ch->rto;
+	double rate = ch->delivery_rate;
+	if(rate <= 0) {
+		/* until measured, assume the channel delivers a full window per round trip */
+		rate = (double) snd->window * snd->packet_size / rtt;
+	}
+	double loss = (ch->loss_rate < MAX_LOSS_RATE) ? ch->loss_rate : MAX_LOSS_RATE;
+	return (ch->bytes_in_flight + size) / rate + rtt + loss / (1 - loss) * ch->rto;
+}
+
+/**
+ * Chooses the channel for the next packet, the one with a free slot that is
+ * expected to deliver it first. If a channel without a free slot would
+ * deliver it clearly sooner even after the packets ahead of it, the packet is
+ * held back until that channel has room, so that a slow or lossy channel
+ * does not delay the stream. An idle channel is always given a packet, which
+ * keeps its estimates current.
+ * @param snd	The transfer
+ * @param size	The payload bytes of the packet
+ *
+ * @return The channel, or NULL if the packet should wait
+ */
+Channel* pick_channel(Sender* snd, uint32_t size) {
+	Channel* best = NULL;
+	Channel* best_free = NULL;
+	double best_time = 0, best_free_time = 0;
+	for(int i = 0; i < snd->num_channels; i++) {
+		Channel* ch = &snd->channels[i];
+		if(ch->state != CH_OPEN) {
+			continue;
+		}
+		double time = expected_delivery(ch, size);
+		if(best == NULL || time < best_time) {
+			best = ch;
+			best_time = time;
+		}
+		if(ch->num_in_flight < snd->window && (best_free == NULL || time < best_free_time)) {
+			best_free = ch;
+			best_free_time = time;
+		}
+	}
+	if(best_free != NULL && best_free != best && best_free->num_in_flight > 0 &&
+		best_free_time > best_time * HOLD_MARGIN) {
+		return NULL;
+	}
+	return best_free;
+}
+
+/**
+ * Assigns packets to the free slots of the open channels and sends them, the
+ * packets of broken channels first and then new packets from the file, each
+ * to the channel expected to deliver it first
+ * @param snd	The transfer
+ */
+void schedule_packets(Sender* snd) {
+	while(snd->num_orphans > 0 || (snd->is_file_done == 0 && is_send_window_open(snd))) {
+		Channel* ch = pick_channel(snd, snd->packet_size);
+		if(ch == NULL) {
+			break;
+		}
+		Slot* slot = ch->slots;
+		while(slot->state != 0) {
+			slot++;
+		}
+		if(adopt_orphan(snd, slot)) {
+			send_slot_packet(ch, slot);
+			continue;
+		}
+		if(snd->is_file_done || !is_send_window_open(snd)) {
+			break;
+		}
+
+		/* generate and send new packet for the slot */
+		slot->trans_count = 0;
+		create_packet(snd, slot, ch->channel_no);
+		send_slot_packet(ch, slot);
+
+		if(slot->pkt.is_last) {
+			/* last packet generated */
+			snd->is_file_done = 1;
+		}
 	}
-	pkt0_trans_count++;
-	state_ch0 = 1;
-	print_packet(&ch0_pkt);
+}
 
-	if(ch0_pkt.is_last) {
-		state_ch0 = 2;
-		fclose(fptr);
+/**
+ * Updates the delivery rate of a channel with the bytes acknowledged over
+ * about a round trip. A sample taken while the channel had free slots only
+ * shows how much it was given, so it may raise the estimate but not lower it.
+ * @param ch	The channel
+ * @param now	The current monotonic time in micro-seconds
+ */
+void sample_delivery_rate(Channel* ch, uint64_t now) {
+	if(ch->rate_start_usec == 0 || ch->delivered == 0) {
+		ch->rate_start_usec = now;
+		ch->delivered = 0;
+		return;
 	}
+	uint64_t elapsed = now - ch->rate_start_usec;
+	if(elapsed < ch->srtt || elapsed < TIMER_TICK_USEC) {
+		return;
+	}
+	double sample = (double) ch->delivered / elapsed;
+	if(ch->delivery_rate <= 0) {
+		ch->delivery_rate = sample;
+	} else if(sample > ch->delivery_rate || ch->num_in_flight == ch->sender->window) {
+		ch->delivery_rate = (7 * ch->delivery_rate + sample) / 8;
+	}
+	ch->rate_start_usec = now;
+	ch->delivered = 0;
+}
 
-	if(state_ch0 != 2) {
-		ch1_pkt = create_packet(fptr, 1);
-		/* File requires more than 1 packet */
-		if(send(fds[1], &ch1_pkt, sizeof(Packet), 0) < 0) {
-			report_error("Failed to perform send()");
+/**
+ * Takes a channel out of the transfer after its connection has broken, or
+ * after a replacement connection has failed. The packets in flight on it are
+ * sent again on the other channels, and a replacement connection is
+ * attempted after a delay, which doubles with every failed attempt.
+ * @param ch		The channel
+ * @param reason	Why the channel is taken out
+ */
+void channel_failed(Channel* ch, const char* reason) {
+	Sender* snd = ch->sender;
+	if(ch->state == CH_OPEN) {
+		printf("Channel %d broken (%s), its packets are sent on the other channels\n", ch->channel_no, reason);
+		ch->failovers++;
+		for(int j = 0; j < snd->window; j++) {
+			Slot* slot = &ch->slots[j];
+			if(slot->state != 1) {
+				continue;
+			}
+			timer_cancel(&snd->timers, &slot->timer);
+			Orphan* orphan = &snd->orphans[snd->num_orphans++];
+			orphan->pkt = slot->pkt;
+			orphan->buf = slot->buf; /* the reference of the slot moves to the orphan */
+			slot->buf = POOL_NONE;
+			slot->state = 0;
 		}
-		pkt1_trans_count++;
-		state_ch1 = 1;
-		print_packet(&ch1_pkt);
+		ch->num_in_flight = 0;
+		ch->bytes_in_flight = 0;
 	} else {
-		/* last packet already sent */
-		time_left_1_sec = __LONG_LONG_MAX__;
-		state_ch1 = 2;
+		printf("Channel %d could not be re-established (%s)\n", ch->channel_no, reason);
+	}
+	if(ch->state != CH_DOWN) {
+		event_loop_del(snd->loop, &ch->src);
+		close(ch->conn.fd);
+		conn_destroy(&ch->conn);
+		impair_destroy(&ch->impair);
 	}
 
-	int is_last_ackd = 0;
+	if(ch->reconnects < MAX_RECONNECTS) {
+		ch->state = CH_DOWN;
+		timer_arm(&snd->timers, &ch->reconnect_timer, (uint64_t) (RECONNECT_DELAY_MS << ch->reconnects) * 1000);
+		ch->reconnects++;
+	} else {
+		ch->state = CH_DEAD;
+		printf("Channel %d given up after %d attempts to re-establish it\n", ch->channel_no, MAX_RECONNECTS);
+		int num_dead = 0;
+		for(int i = 0; i < snd->num_channels; i++) {
+			num_dead += (snd->channels[i].state == CH_DEAD);
+		}
+		if(num_dead == snd->num_channels) {
+			fprintf(stderr, "Failed to transmit file, all channels are broken. Terminating Program\n");
+			exit(1);
+		}
+	}
+
+	/* the packets of the channel move to the others */
+	schedule_packets(snd);
+}
+
+/**
+ * Timer handler of a broken channel, starts connecting a replacement
+ * @param timer	The expired reconnection timer
+ * @param arg	The channel
+ */
+void on_reconnect_timeout(Timer* timer, void* arg) {
+	Channel* ch = arg;
+	int fd = start_connection();
+	if(fd < 0) {
+		channel_failed(ch, strerror(errno));
+		return;
+	}
+	if(conn_init(&ch->conn, fd, MAX_HELLO_SIZE) < 0) {
+		/* a channel that is down has no connection for channel_failed() to release */
+		close(fd);
+		conn_destroy(&ch->conn);
+		channel_failed(ch, "failed to allocate connection buffers");
+		return;
+	}
+	ch->src.fd = fd;
+	if(event_loop_add(ch->sender->loop, &ch->src, EPOLLIN | EPOLLOUT | EPOLLET) < 0) {
+		close(fd);
+		conn_destroy(&ch->conn);
+		channel_failed(ch, "failed to watch channel");
+		return;
+	}
+	ch->state = CH_CONNECTING;
+}
+
+/**
+ * Timer handler of a slot, retransmits its packet unless the channel is
+ * assumed to be broken. A channel is judged by whether it still delivers: an
+ * ACK received on it, or a packet of it acknowledged on any channel, counts.
+ * Lost ACKs or a packet lost repeatedly do not break a channel that delivers
+ * otherwise, while one that delivers nothing at all moves its packets to the
+ * other channels within a few seconds. The packet must have been retransmitted
+ * a few times as well, so a channel whose RTT is not measured yet, and whose
+ * retransmissions are hence few and far between, is not failed over a handful
+ * of lost ACKs.
+ * @param timer	The expired retransmission timer
+ * @param arg	The slot
+ */
+void on_slot_timeout(Timer* timer, void* arg) {
+	Slot* slot = arg;
+	Channel* ch = slot->channel;
+	uint64_t stalled = monotonic_usec() - ch->progress_usec;
+	if(stalled >= stall_timeout(ch) && slot->trans_count > STALL_RETRANSMITS) {
+		char reason[64];
+		snprintf(reason, sizeof(reason), "nothing delivered for %" PRIu64 " ms", stalled / 1000);
+		channel_failed(ch, reason);
+		return;
+	}
 
-	while(is_last_ackd == 0) {
-		/* preparing FD_SET for select() */
-		fd_set read_fds;
-		FD_ZERO(&read_fds);
-		int i;
-		for(i = 0; i < 2; i++) {
-			FD_SET(fds[i], &read_fds);
+	/* retransmit packet */
+	send_slot_packet(ch, slot);
+}
+
+/**
+ * Checks whether a packet has been received by the server according to an
+ * acknowledgement. An empty packet (the only packet of an empty file) is only
+ * acknowledged by the final ACK. The payload of a compressed packet is
+ * shorter than its part of the stream, but acknowledged ranges always end at
+ * the boundaries of packets.
+ * @param pkt			The packet
+ * @param cum_ack		The cumulative sequence no. of the acknowledgement
+ * @param blocks		The ranges acknowledged out of order
+ * @param num_blocks	The no. of ranges
+ * 
+ * @return 1 if the packet has been acknowledged, 0 otherwise
+ */
+int is_acknowledged(Packet* pkt, uint64_t cum_ack, SackBlock* blocks, int num_blocks) {
+	uint64_t end = pkt->seq_no + pkt->payload_size;
+	if(pkt->payload_size == 0) {
+		return 0;
+	}
+	if(end <= cum_ack) {
+		return 1;
+	}
+	for(int i = 0; i < num_blocks; i++) {
+		if(pkt->seq_no >= blocks[i].start && end <= blocks[i].end) {
+			return 1;
 		}
+	}
+	return 0;
+}
 
-		struct timeval timeout;
-		min_time_sock = min_time_channel(time_left_0_sec, time_left_0_usec, time_left_1_sec, time_left_1_usec);
+/**
+ * Records the ACK latency of a packet. Samples are dropped if there is no
+ * memory left for them.
+ * @param snd		The transfer
+ * @param latency	The time from the first transmission of the packet to
+ * 					its acknowledgement in micro-seconds
+ */
+void record_latency(Sender* snd, uint64_t latency) {
+	if(snd->num_latencies == snd->latency_capacity) {
+		size_t capacity = (snd->latency_capacity > 0) ? 2 * snd->latency_capacity : 1024;
+		uint32_t* latencies = realloc(snd->latencies, capacity * sizeof(uint32_t));
+		if(latencies == NULL) {
+			return;
+		}
+		snd->latencies = latencies;
+		snd->latency_capacity = capacity;
+	}
+	snd->latencies[snd->num_latencies++] = (latency < UINT32_MAX) ? latency : UINT32_MAX;
+}
 
-		if(min_time_sock == 0) {
-			timeout.tv_sec = time_left_0_sec;
-			timeout.tv_usec = time_left_0_usec;
-		} else {
-			timeout.tv_sec = time_left_1_sec;
-			timeout.tv_usec - time_left_1_usec;
-		}
-
-		/* noting time before select call */
-		clock_t start = clock();
-
-		/* select call */
-		int num_ready = select(max_fd, &read_fds, NULL, NULL, &timeout);
-
-		int is_ch0_updated = 0;
-		int is_ch1_updated = 0;
-
-		if(num_ready == 0) {
-			/* timeout occurred */
-			if(min_time_sock == 0) {
-				/* channel 0 timeout */
-				if(pkt0_trans_count >= MAX_RETRIES) {
-					/* assume channel broken */
-					fprintf(stderr, "Failed to transmit file due to exceeded max retries. Terminating Program\n");
-					close(fds[0]);
-					close(fds[1]);
-					exit(0);
-				} else {
-					/* retransmit packet */
-					if(send(fds[0], &ch0_pkt, sizeof(Packet), 0) < 0) {
-						report_error("Failed to perform send()");
-					}
-					pkt0_trans_count++;
-					state_ch0 = 1;
-					/* print trace of packet */
-					print_packet(&ch0_pkt);
-
-					/* recompute timers */
-					time_left_0_sec = RETRANSMISSION_TIMEOUT;
-					time_left_0_usec = 0;
-					is_ch0_updated = 1;
-				}
-			} else {
-				/* channel 1 timeout */
-				if(pkt1_trans_count >= MAX_RETRIES) {
-					/* assume channel broken */
-					fprintf(stderr, "Failed to transmit file due to exceeded max retries. Terminating Program\n");
-					close(fds[0]);
-					close(fds[1]);
-					exit(0);
-				} else {
-					/* retransmit packet */
-					if(send(fds[1], &ch1_pkt, sizeof(Packet), 0) < 0) {
-						report_error("Failed to perform send()");
-					}
-					pkt1_trans_count++;
-					state_ch1 = 1;
-
-					/* print trace of packet */
-					print_packet(&ch1_pkt);
-
-					/* recompute timers */
-					time_left_1_sec = RETRANSMISSION_TIMEOUT;
-					time_left_1_usec = 0;
-					is_ch1_updated = 1;
-				}
+/**
+ * Handles an acknowledgement received on a channel: releases the slots of
+ * all packets it acknowledges, cumulatively or selectively, on any channel
+ * and refills the windows
+ * @param ch	The channel on which the acknowledgement was received
+ * @param ack	The acknowledgement
+ */
+void handle_ack(Channel* ch, Packet* ack) {
+	Sender* snd = ch->sender;
+
+	if(ack->type != PKT_ACK) {
+		/* parameters are only negotiated at connection start */
+		return;
+	}
+
+	/* trace the acknowledgement */
+	trace_packet(snd, TRACE_ACK_RECEIVED, ack);
+	uint64_t now = monotonic_usec();
+	ch->progress_usec = now;
+
+	if(ack->is_last) {
+		snd->is_last_ackd = 1;
+		snd->server_digest = ack->checksum;
+		return;
+	}
+	if(ack->seq_no > snd->cum_ack) {
+		snd->cum_ack = ack->seq_no;
+	}
+
+	SackBlock blocks[MAX_SACK_BLOCKS];
+	int num_blocks = decode_sack((unsigned char*) ack->payload, ack->payload_size, blocks);
+	if(num_blocks < 0) {
+		fprintf(stderr, "Received malformed acknowledgement. Terminating Program\n");
+		exit(1);
+	}
+
+	/* release the slots of the acknowledged packets */
+	for(int i = 0; i < snd->num_channels; i++) {
+		Channel* slot_ch = &snd->channels[i];
+		for(int j = 0; j < snd->window; j++) {
+			Slot* slot = &slot_ch->slots[j];
+			if(slot->state != 1 || !is_acknowledged(&slot->pkt, ack->seq_no, blocks, num_blocks)) {
+				continue;
 			}
-		} else {
-			/* FD_ISSET check to identify which fd has received ack */
-			if(FD_ISSET(fds[0], &read_fds)) {
-				/* receive the ack */
-				if(recv(fds[0], &ch0_pkt, sizeof(Packet), 0) < 0) {
-					report_error("Failed to receive");
-				}
+			slot->state = 0;
+			timer_cancel(&snd->timers, &slot->timer);
+			pool_release(&snd->buffers, slot->buf); /* a copy still queued for sending keeps its own reference */
+			slot->buf = POOL_NONE;
+			slot_ch->num_in_flight--;
+			slot_ch->bytes_in_flight -= slot->pkt.payload_size;
+			slot_ch->delivered += slot->pkt.payload_size;
+			slot_ch->progress_usec = now;
+			record_latency(snd, now - slot->first_sent_usec);
 
-				/* print the acknowledgement trace */
-				print_packet(&ch0_pkt);
-				if(ch0_pkt.is_last) {
-					is_last_ackd = 1;
-				} else if(state_ch0 != 2 && state_ch1 != 2) {
-					/* last packet not yet sent */
-					state_ch0 = 0;
-					pkt0_trans_count = 0;
-
-					/* generate new packet for channel 0 */
-					ch0_pkt = create_packet(fptr, 0);
-
-					/* send the new packet */
-					if(send(fds[0], &ch0_pkt, sizeof(Packet), 0) < 0) {
-						report_error("Failed to send packet");
-					}
-					state_ch0 = 1;
-					pkt0_trans_count++;
-
-					/* print the newly transmitted packet */
-					print_packet(&ch0_pkt);
-
-					/* update timer */
-					time_left_0_sec = RETRANSMISSION_TIMEOUT;
-					time_left_0_usec = 0;
-					is_ch0_updated = 1;
-
-					if(ch0_pkt.is_last) {
-						/* last packet, perform cleanup */
-						state_ch0 = 2;
-						fclose(fptr);
-					}
-				} else {
-					if(ch0_pkt.is_last) {
-						is_last_ackd = 1;
-					}
-					time_left_0_sec = __LONG_LONG_MAX__;
-					state_ch0 = 2;
-				}
+			/* Karn's rule: the ACK of a retransmitted packet is ambiguous, no RTT sample */
+			if(slot->trans_count == 1) {
+				update_rto(slot_ch, now - slot->sent_usec);
+				histogram_add(&snd->rtt_histogram, now - slot->sent_usec);
 			}
+			slot_ch->loss_rate += ((slot->trans_count > 1) - slot_ch->loss_rate) / 16;
+		}
+		if(slot_ch->state == CH_OPEN) {
+			sample_delivery_rate(slot_ch, now);
+		}
+	}
 
-			if(FD_ISSET(fds[1], &read_fds)) {
-				/* receive the ack */
-				if(recv(fds[1], &ch1_pkt, sizeof(Packet), 0) < 0) {
-					report_error("Failed to receive");
-				}
+	/* the send window may have opened, refill the windows if the last packet is not yet sent */
+	schedule_packets(snd);
+}
+
+void on_channel_ready(int fd, uint32_t events, void* arg);
+
+/**
+ * Timer handler of the impairer of a channel, receives the acknowledgements
+ * that have become due
+ * @param timer	The expired timer
+ * @param arg	The channel
+ */
+void on_impair_timeout(Timer* timer, void* arg) {
+	Channel* ch = arg;
+	on_channel_ready(ch->conn.fd, EPOLLIN, ch);
+}
+
+/**
+ * Timer handler printing the progress of the transfer, rearms itself
+ * @param timer	The expired timer
+ * @param arg	The transfer
+ */
+void on_stats_timeout(Timer* timer, void* arg) {
+	Sender* snd = arg;
+	uint64_t elapsed = monotonic_usec() - snd->start_usec;
+	int retransmissions = 0, in_flight = 0;
+	for(int i = 0; i < snd->num_channels; i++) {
+		retransmissions += snd->channels[i].retransmissions;
+		in_flight += snd->channels[i].num_in_flight;
+	}
+	printf("%6.1f s  %" PRIu64 " of %zu bytes acknowledged (%.1f%%)  %.2f MB/s  %d retransmissions  %d in flight\n",
+		elapsed / 1000000.0, snd->cum_ack, snd->file_size,
+		(snd->file_size > 0) ? snd->cum_ack * 100.0 / snd->file_size : 100.0,
+		(elapsed > 0) ? snd->cum_ack * 1000000.0 / elapsed / 1048576 : 0, retransmissions, in_flight);
+	timer_arm(&snd->timers, timer, STATS_INTERVAL_MS * 1000);
+}
+
+/**
+ * Advances a replacement connection of a broken channel: once connected, it
+ * asks the server to let it rejoin the transfer, and once the server has
+ * accepted it, the channel is open again
+ * @param ch		The channel
+ * @param events	The events reported for the socket
+ *
+ * @return 1 if the channel is open, 0 otherwise
+ */
+int rejoin(Channel* ch, uint32_t events) {
+	Sender* snd = ch->sender;
+	if(ch->state == CH_CONNECTING) {
+		int error = 0;
+		socklen_t len = sizeof(error);
+		if(!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+			return 0;
+		}
+		if(getsockopt(ch->conn.fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+			error = errno;
+		}
+		if(error != 0) {
+			channel_failed(ch, strerror(error));
+			return 0;
+		}
+
+		Packet hello;
+		memset(&hello, 0, sizeof(Packet));
+		hello.type = PKT_REJOIN;
+		hello.channel_no = ch->channel_no;
+		hello.payload = (char*) snd->hello;
+		hello.payload_size = snd->hello_size;
+		if(conn_queue_packet(&ch->conn, &hello) < 0 || conn_flush(&ch->conn) < 0) {
+			channel_failed(ch, "failed to send HELLO");
+			return 0;
+		}
+		ch->state = CH_JOINING;
+	}
+
+	Packet reply;
+	Hello accepted;
+	int status = conn_recv_packet(&ch->conn, &reply);
+	if(status == 0) {
+		return 0;
+	}
+	if(status == 1 && reply.type == PKT_REFUSE) {
+		char reason[MAX_HELLO_SIZE + 32];
+		snprintf(reason, sizeof(reason), "refused by server: %.*s", (int) reply.payload_size, reply.payload);
+		channel_failed(ch, reason);
+		return 0;
+	}
+	if(status != 1 || reply.type != PKT_HELLO ||
+		decode_hello((unsigned char*) reply.payload, reply.payload_size, &accepted) < 0 ||
+		accepted.session_id != snd->session_id) {
+		channel_failed(ch, "rejected by server");
+		return 0;
+	}
+
+	/* from now on only acknowledgements are received */
+	ch->conn.max_payload = MAX_SACK_BLOCKS * SACK_BLOCK_SIZE;
+	impair_init(&ch->impair, &snd->impair[ch->channel_no], ch->channel_no, &snd->timers, on_impair_timeout, ch);
+	ch->impair.trace = snd->trace;
+	ch->impair.session_id = snd->session_id;
+	ch->state = CH_OPEN;
+	ch->reconnects = 0;
+	printf("Channel %d re-established\n", ch->channel_no);
+	ch->rate_start_usec = 0;
+	schedule_packets(snd);
+	return 1;
+}
+
+/**
+ * Event loop handler of a channel, sends the queued packets and receives all
+ * the acknowledgements available on it
+ * @param fd		The channel's socket
+ * @param events	The events reported for the socket
+ * @param arg		The channel
+ */
+void on_channel_ready(int fd, uint32_t events, void* arg) {
+	Channel* ch = arg;
+	Packet ack;
+	int status;
+
+	if(ch->state != CH_OPEN && !rejoin(ch, events)) {
+		return;
+	}
+
+	/* resume sending the packets queued while the socket was full */
+	if((events & EPOLLOUT) && conn_flush(&ch->conn) < 0) {
+		channel_failed(ch, strerror(errno));
+		return;
+	}
+
+	/* edge-triggered, so drain the socket completely */
+	while(ch->sender->is_last_ackd == 0 && (status = impair_recv_packet(&ch->impair, &ch->conn, &ack)) == 1) {
+		handle_ack(ch, &ack);
+	}
+	if(ch->sender->is_last_ackd) {
+		return;
+	}
+	if(status == -1) {
+		channel_failed(ch, strerror(errno));
+	} else if(status == -2) {
+		channel_failed(ch, "connection closed by server");
+	}
+}
+
+/**
+ * Sends the packets queued on every channel. Packets generated or
+ * retransmitted while handling the events of one wait are queued, so that
+ * each channel sends them with a single system call.
+ * @param snd	The transfer
+ */
+void flush_channels(Sender* snd) {
+	for(int i = 0; i < snd->num_channels; i++) {
+		Channel* ch = &snd->channels[i];
+		if(ch->state == CH_OPEN && ch->conn.tx_count > 0 && conn_flush(&ch->conn) < 0) {
+			channel_failed(ch, strerror(errno));
+		}
+	}
+}
+
+/**
+ * Comparison function of qsort() for ACK latencies
+ */
+int compare_latencies(const void* a, const void* b) {
+	uint32_t x = *(const uint32_t*) a;
+	uint32_t y = *(const uint32_t*) b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Looks up a percentile of the ACK latencies, which must have been sorted
+ * @param snd			The transfer
+ * @param percentile	The percentile, 0 to 100
+ *
+ * @return The latency in milli-seconds, 0 if there are no samples
+ */
+double latency_percentile(Sender* snd, int percentile) {
+	if(snd->num_latencies == 0) {
+		return 0;
+	}
+	return snd->latencies[(snd->num_latencies - 1) * percentile / 100] / 1000.0;
+}
+
+/**
+ * Writes a summary of a completed transfer as a JSON object on a single
+ * line, for the benchmarks. The ACK latencies must have been sorted.
+ * @param snd		The transfer
+ * @param path		The file to be written
+ * @param elapsed	The duration of the transfer in micro-seconds
+ *
+ * @return 0 on success, -1 on failure
+ */
+int write_summary(Sender* snd, const char* path, uint64_t elapsed) {
+	FILE* f = fopen(path, "w");
+	if(f == NULL) {
+		return -1;
+	}
+	int pkts_sent = 0, retransmissions = 0, failovers = 0;
+	for(int i = 0; i < snd->num_channels; i++) {
+		pkts_sent += snd->channels[i].pkts_sent;
+		retransmissions += snd->channels[i].retransmissions;
+		failovers += snd->channels[i].failovers;
+	}
+	double seconds = elapsed / 1000000.0;
+	fprintf(f, "{\"bytes\": %zu, \"channels\": %d, \"window\": %d, \"packet_size\": %" PRIu32 ", "
+		"\"seconds\": %.6f, \"mb_per_s\": %.3f, \"packets_sent\": %d, \"retransmissions\": %d, "
+		"\"failovers\": %d, \"ack_p50_ms\": %.3f, \"ack_p90_ms\": %.3f, \"ack_p99_ms\": %.3f, "
+		"\"ack_max_ms\": %.3f, \"checksum_ms\": %.3f, \"wire_bytes\": %" PRIu64 ", \"compress_ms\": %.3f, "
+		"\"verified\": %s}\n", snd->file_size, snd->num_channels,
+		snd->window, snd->packet_size, seconds, (seconds > 0) ? snd->file_size / 1048576.0 / seconds : 0, pkts_sent,
+		retransmissions, failovers, latency_percentile(snd, 50), latency_percentile(snd, 90),
+		latency_percentile(snd, 99), latency_percentile(snd, 100), snd->checksum_usec / 1000.0,
+		snd->wire_bytes, snd->compress_usec / 1000.0, (snd->digest == snd->server_digest) ? "true" : "false");
+	return fclose(f);
+}
+
+/**
+ * Prints the statistics of every channel of a transfer. The ACK latencies
+ * must have been sorted.
+ * @param snd	The transfer
+ */
+void print_stats(Sender* snd) {
+	unsigned long syscalls = 0;
+	printf("\nChannel  Sent  Retransmitted  Failovers  SRTT (ms)  RTTVAR (ms)  RTO (ms)  Loss (%%)  Rate (MB/s)  Send calls  Recv calls\n");
+	for(int i = 0; i < snd->num_channels; i++) {
+		Channel* ch = &snd->channels[i];
+		printf("%7d  %4d  %13d  %9d  %9.3f  %11.3f  %8.3f  %8.1f  %11.2f  %10lu  %10lu\n", ch->channel_no, ch->pkts_sent,
+			ch->retransmissions, ch->failovers, ch->srtt / 1000.0, ch->rttvar / 1000.0, ch->rto / 1000.0,
+			ch->loss_rate * 100, ch->delivery_rate * 1000000 / 1048576, ch->conn.send_calls, ch->conn.recv_calls);
+		syscalls += ch->conn.send_calls + ch->conn.recv_calls;
+	}
+	if(snd->file_size > 0) {
+		printf("Socket system calls per MB: %.1f\n", syscalls / (snd->file_size / 1048576.0));
+	}
+	printf("ACK latency (ms): p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n", latency_percentile(snd, 50),
+		latency_percentile(snd, 90), latency_percentile(snd, 99), latency_percentile(snd, 100));
+	printf("Checksums (%s): %.3f ms in the sending thread\n", crc32c_impl(), snd->checksum_usec / 1000.0);
+	if(snd->prefetch.hits + snd->prefetch.misses > 0) {
+		printf("Read-ahead: %lu of %lu packets read and checksummed in %.3f ms by the reader thread\n",
+			snd->prefetch.hits, snd->prefetch.hits + snd->prefetch.misses, snd->prefetch.read_usec / 1000.0);
+	}
+	if(snd->compressor != NULL && snd->num_packets > 0) {
+		printf("Compression: %lu of %lu packets, %" PRIu64 " payload bytes on the wire (%.1f%%), %.3f ms\n",
+			snd->num_compressed, snd->num_packets, snd->wire_bytes, (snd->raw_bytes > 0) ? snd->wire_bytes * 100.0 / snd->raw_bytes : 100.0,
+			snd->compress_usec / 1000.0);
+	}
+	if(snd->rtt_histogram.count > 0) {
+		histogram_print(&snd->rtt_histogram, "RTT samples (us):");
+	}
+
+	unsigned long dropped = 0, duplicated = 0, reordered = 0;
+	for(int i = 0; i < snd->num_channels; i++) {
+		dropped += snd->channels[i].impair.dropped;
+		duplicated += snd->channels[i].impair.duplicated;
+		reordered += snd->channels[i].impair.reordered;
+	}
+	if(dropped + duplicated + reordered > 0) {
+		printf("The simulated link dropped %lu, duplicated %lu and reordered %lu ACKs\n", dropped, duplicated, reordered);
+	}
+}
+
+/**
+ * Negotiates the parameters of the transfer on a freshly connected channel.
+ * Blocks until the server has answered.
+ * @param ch		The channel
+ * @param proposed	The parameters proposed to the server
+ * @param accepted	Output, the parameters accepted by the server
+ */
+void negotiate(Channel* ch, Hello* proposed, Hello* accepted) {
+	unsigned char payload[MAX_HELLO_SIZE];
+
+	Packet hello;
+	memset(&hello, 0, sizeof(Packet));
+	hello.type = PKT_HELLO;
+	hello.channel_no = ch->channel_no;
+	hello.payload = (char*) payload;
+	hello.payload_size = encode_hello(proposed, payload);
+	if(conn_send_packet(&ch->conn, &hello) < 0) {
+		report_error("Failed to send HELLO to server");
+	}
+
+	Packet reply;
+	int status = conn_recv_packet(&ch->conn, &reply);
+	if(status == 1 && reply.type == PKT_REFUSE) {
+		fprintf(stderr, "Server refused the transfer: %.*s\n", (int) reply.payload_size, reply.payload);
+		exit(1);
+	}
+	if(status != 1 || reply.type != PKT_HELLO ||
+		decode_hello((unsigned char*) reply.payload, reply.payload_size, accepted) < 0) {
+		report_error("Failed to receive HELLO from server");
+	}
+	if(accepted->packet_size < 1 || accepted->packet_size > proposed->packet_size) {
+		fprintf(stderr, "Server accepted an invalid packet size. Terminating Program\n");
+		exit(1);
+	}
+	if(accepted->window < 1 || accepted->window > proposed->window) {
+		fprintf(stderr, "Server accepted an invalid window size. Terminating Program\n");
+		exit(1);
+	}
+	if(accepted->start_seq > proposed->start_seq || accepted->start_seq % accepted->packet_size != 0 ||
+		(accepted->start_seq > 0 && accepted->start_seq >= proposed->file_size)) {
+		fprintf(stderr, "Server accepted an invalid resume offset. Terminating Program\n");
+		exit(1);
+	}
+
+	/* from now on only acknowledgements are received */
+	ch->conn.max_payload = MAX_SACK_BLOCKS * SACK_BLOCK_SIZE;
+}
 
-				/* print the acknowledgement trace */
-				print_packet(&ch1_pkt);
-
-				if(ch0_pkt.is_last) {
-					is_last_ackd = 1;
-				} else if(state_ch0 != 2 && state_ch1 != 2) {
-					/* last packet not yet sent */
-					state_ch1 = 0;
-					pkt1_trans_count = 0;
-
-					/* generate new packet for channel 0 */
-					ch1_pkt = create_packet(fptr, 1);
-
-					/* send the new packet */
-					if(send(fds[1], &ch1_pkt, sizeof(Packet), 0) < 0) {
-						report_error("Failed to send packet");
-					}
-					state_ch1 = 1;
-					pkt1_trans_count++;
-
-					/* print the newly transmitted packet */
-					print_packet(&ch1_pkt);
-
-					/* update timer */
-					time_left_1_sec = RETRANSMISSION_TIMEOUT;
-					time_left_1_usec = 0;
-					is_ch1_updated = 1;
-
-					if(ch1_pkt.is_last) {
-						/* last packet, perform cleanup */
-						state_ch1 = 2;
-						fclose(fptr);
-					}
-				} else {
-					time_left_1_sec = __LONG_LONG_MAX__;
-					state_ch1 = 2;
-					if(ch1_pkt.is_last) {
-						is_last_ackd = 1;
-					}
+/**
+ * Generates the session ID identifying the channels of this transfer to the
+ * server, unique among the transfers the server is receiving concurrently
+ * 
+ * @return The session ID
+ */
+uint64_t new_session_id(void) {
+	uint64_t id;
+	if(getrandom(&id, sizeof(id), 0) == sizeof(id)) {
+		return id;
+	}
+	return ((uint64_t) time(0) << 32) ^ ((uint64_t) getpid() << 16) ^ monotonic_usec();
+}
+
+int main(int argc, char* argv[]) {
+	int num_channels = DEFAULT_CHANNELS;
+	int window = DEFAULT_WINDOW;
+	long packet_size = DEFAULT_PACKET_SIZE;
+	const char* input_path = NULL;
+	const char* dest_name = NULL;
+	const char* summary_path = NULL;
+	const char* trace_path = NULL;
+	int verbosity = VERBOSITY_PROGRESS;
+	int opt, i, j;
+	int resume = 0;
+	int compress = 0;
+	long initial_rto = RETRANSMISSION_TIMEOUT * 1000;
+	ImpairConfig impair[MAX_CHANNELS]; /* the client impairs nothing unless specified */
+	for(i = 0; i < MAX_CHANNELS; i++) {
+		impair_config_init(&impair[i]);
+		impair[i].seed = time(0);
+	}
+
+	/* parse command line options */
+	while((opt = getopt(argc, argv, "c:w:s:f:o:rt:j:i:v:T:z")) != -1) {
+		switch(opt) {
+			case 'c': {
+				num_channels = atoi(optarg);
+			}
+			break;
+			case 'w': {
+				window = atoi(optarg);
+			}
+			break;
+			case 's': {
+				packet_size = atol(optarg);
+			}
+			break;
+			case 'f': {
+				input_path = optarg;
+			}
+			break;
+			case 'o': {
+				dest_name = optarg;
+			}
+			break;
+			case 'r': {
+				resume = 1;
+			}
+			break;
+			case 't': {
+				initial_rto = atol(optarg);
+			}
+			break;
+			case 'j': {
+				summary_path = optarg;
+			}
+			break;
+			case 'i': {
+				if(impair_config_parse(impair, MAX_CHANNELS, optarg) < 0) {
+					fprintf(stderr, "Invalid impairment: %s\n", optarg);
+					exit(1);
 				}
 			}
+			break;
+			case 'v': {
+				verbosity = atoi(optarg);
+			}
+			break;
+			case 'T': {
+				trace_path = optarg;
+			}
+			break;
+			case 'z': {
+				compress = 1;
+			}
+			break;
+			default: {
+				fprintf(stderr, "Usage: %s [-c channels] [-w window] [-s packet_size] [-f input_file] [-o dest_name] [-r] [-t initial_rto_ms] [-j summary_file] [-i impairment] [-v verbosity] [-T trace_file] [-z] [file|dir ...]\n",
+					argv[0]);
+				exit(1);
+			}
 		}
-		
-		/* noting time after select call (ignoring time taken for computation for simplicity) */
-		clock_t end = clock();
+	}
+	if(num_channels < 1 || num_channels > MAX_CHANNELS) {
+		fprintf(stderr, "No. of channels must be between 1 and %d\n", MAX_CHANNELS);
+		exit(1);
+	}
+	if(window < 1 || window > MAX_WINDOW) {
+		fprintf(stderr, "Window size must be between 1 and %d\n", MAX_WINDOW);
+		exit(1);
+	}
+	if(packet_size < 1 || packet_size > MAX_PACKET_SIZE) {
+		fprintf(stderr, "Packet size must be between 1 and %d\n", MAX_PACKET_SIZE);
+		exit(1);
+	}
+	if(initial_rto < MIN_RTO_USEC / 1000 || initial_rto > MAX_RTO_USEC / 1000) {
+		fprintf(stderr, "Initial retransmission timeout must be between %d and %d ms\n", MIN_RTO_USEC / 1000,
+			MAX_RTO_USEC / 1000);
+		exit(1);
+	}
 
-		double time_taken = (end - start) / (double) CLOCKS_PER_SEC;
+	/* the files to be sent: a single file as before, or a tree of several files and directories */
+	int num_paths = 0;
+	char** paths = calloc(argc + 1, sizeof(char*));
+	if(paths == NULL) {
+		report_error("Failed to allocate paths");
+	}
+	if(input_path != NULL) {
+		paths[num_paths++] = (char*) input_path;
+	}
+	for(i = optind; i < argc; i++) {
+		paths[num_paths++] = argv[i];
+	}
+	if(num_paths == 0) {
+		paths[num_paths++] = "input.txt";
+	}
+	struct stat st;
+	int is_tree = (num_paths > 1 || (stat(paths[0], &st) == 0 && S_ISDIR(st.st_mode)));
+	if(dest_name == NULL) {
+		/* a single directory keeps its name */
+		const char* name = is_tree ? "files" : "output.txt";
+		if(is_tree && num_paths == 1) {
+			const char* base = strrchr(paths[0], '/');
+			base = (base != NULL && base[1] != '\0') ? base + 1 : paths[0];
+			if(strchr(base, '/') == NULL && strcmp(base, ".") != 0 && strcmp(base, "..") != 0) {
+				name = base;
+			}
+		}
+		dest_name = name;
+	}
+	if(dest_name[0] == '\0' || strlen(dest_name) > MAX_NAME_LEN || strchr(dest_name, '/') != NULL ||
+		strcmp(dest_name, ".") == 0 || strcmp(dest_name, "..") == 0) {
+		fprintf(stderr, "Destination must be a file name of at most %d characters\n", MAX_NAME_LEN);
+		exit(1);
+	}
+
+	EventLoop loop;
+	if(event_loop_init(&loop) < 0) {
+		report_error("Failed to create event loop");
+	}
+
+	Channel channels[MAX_CHANNELS];
+	Sender snd;
+	memset(&snd, 0, sizeof(Sender));
+	snd.window = window;
+	snd.num_channels = num_channels;
+	snd.channels = channels;
+	snd.loop = &loop;
+	snd.impair = impair;
+	snd.verbosity = verbosity;
+	timer_wheel_init(&snd.timers);
+	timer_init(&snd.stats_timer, on_stats_timeout, &snd);
 
-		/* recompute timers */
-		if(is_ch0_updated == 0) {
-			time_left(&time_left_0_sec, &time_left_0_usec, time_taken);
+	/* trace the packets from a thread of its own, recording costs no system calls */
+	Tracer tracer;
+	memset(&tracer, 0, sizeof(Tracer));
+	if(trace_path != NULL) {
+		if(tracer_open(&tracer, trace_path) < 0) {
+			report_error("Failed to open trace file");
+		}
+		if((snd.trace = tracer_add_ring(&tracer)) == NULL || tracer_start(&tracer) < 0) {
+			report_error("Failed to start tracing");
 		}
+	}
 
-		if(is_ch1_updated == 0) {
-			time_left(&time_left_1_sec, &time_left_1_usec, time_taken);
+	/* lay out the stream to be sent, the server learns its size up front */
+	if(is_tree) {
+		if(source_open_tree(&snd.src, paths, num_paths) < 0) {
+			report_error("The requested files could not be read");
 		}
+		printf("Sending %d files (%zu bytes with the manifest) as %s\n", snd.src.num_entries, (size_t) snd.src.size,
+			dest_name);
+	} else if(source_open_file(&snd.src, paths[0]) < 0) {
+		report_error("The requested file could not be read");
 	}
+	snd.file_size = snd.src.size;
+	free(paths);
+
+	/* Creating the channels for communicating with server */
+	Hello proposed = { .packet_size = packet_size, .num_channels = num_channels, .window = window,
+		.session_id = new_session_id(), .file_size = snd.file_size, .manifest_size = snd.src.manifest_size,
+		.file_id = snd.src.file_id };
+	if(resume) {
+		/* let the server resume as far as it has checkpointed */
+		proposed.start_seq = snd.file_size;
+	}
+	strcpy(proposed.name, dest_name);
+	snd.session_id = proposed.session_id;
+	snd.hello_size = encode_hello(&proposed, snd.hello);
+	Hello accepted;
+	for(i = 0; i < num_channels; i++) {
+		Channel* ch = &channels[i];
+		if(conn_init(&ch->conn, create_connection(), MAX_HELLO_SIZE) < 0) {
+			report_error("Failed to allocate connection buffers");
+		}
+		ch->channel_no = i;
+		ch->sender = &snd;
+		ch->has_rtt_sample = 0;
+		ch->srtt = ch->rttvar = 0;
+		ch->rto = (uint64_t) initial_rto * 1000;
+		ch->pkts_sent = ch->retransmissions = ch->failovers = 0;
+		ch->num_in_flight = 0;
+		ch->bytes_in_flight = ch->delivered = ch->rate_start_usec = 0;
+		ch->loss_rate = ch->delivery_rate = 0;
+		ch->state = CH_OPEN;
+		ch->reconnects = 0;
+		timer_init(&ch->reconnect_timer, on_reconnect_timeout, ch);
 
-	close(fds[0]);
-	close(fds[1]);
+		/* agree on the parameters before switching to non-blocking mode */
+		negotiate(ch, &proposed, &accepted);
+		window = snd.window = accepted.window; /* the server may shrink it to fit its reorder buffer */
+		if(make_nonblocking(ch->conn.fd) < 0) {
+			report_error("Could not make socket nonblocking");
+		}
+		impair_init(&ch->impair, &impair[i], i, &snd.timers, on_impair_timeout, ch);
+		ch->impair.trace = snd.trace;
+		ch->impair.session_id = snd.session_id;
 
-	printf("\nFile transfer completed successfully\n");
+		ch->slots = calloc(window, sizeof(Slot));
+		if(ch->slots == NULL) {
+			report_error("Failed to allocate channel window");
+		}
+		for(j = 0; j < window; j++) {
+			ch->slots[j].channel = ch;
+			ch->slots[j].buf = POOL_NONE;
+			timer_init(&ch->slots[j].timer, on_slot_timeout, &ch->slots[j]);
+		}
+		ch->src.fd = ch->conn.fd;
+		ch->src.handler = on_channel_ready;
+		ch->src.arg = ch;
+		if(event_loop_add(&loop, &ch->src, EPOLLIN | EPOLLOUT | EPOLLET) < 0) {
+			report_error("Failed to watch channel");
+		}
+	}
+	snd.packet_size = accepted.packet_size;
+	snd.next_seq = accepted.start_seq;
+	snd.shift = crc32c_shift(snd.packet_size);
+	if(snd.next_seq > 0) {
+		/* the server checks the whole stream, incl. the part it received before */
+		uint64_t start = monotonic_usec();
+		snd.digest = source_digest(&snd.src, snd.next_seq);
+		snd.checksum_usec = monotonic_usec() - start;
+	}
+	if(compress) {
+		snd.compressor = malloc(sizeof(Compressor));
+		if(snd.compressor == NULL) {
+			report_error("Failed to allocate compressor");
+		}
+		compressor_init(snd.compressor);
+	}
+	snd.orphans = calloc((size_t) num_channels * window, sizeof(Orphan));
+	if(snd.orphans == NULL) {
+		report_error("Failed to allocate channel window");
+	}
 
-	return 0;
-}
\ No newline at end of file
+	/*
+	 * a buffer for every slot and every orphan, for an older packet of every
+	 * slot still queued for sending, and for a packet being compressed
+	 */
+	if(pool_init(&snd.buffers, 3 * num_channels * window + 1, snd.packet_size) < 0) {
+		report_error("Failed to allocate packet buffers");
+	}
+	if(snd.next_seq > 0) {
+		printf("Resuming transfer at byte %" PRIu64 " of %zu\n", accepted.start_seq, snd.file_size);
+	}
+
+	/* generate and send the first packets, reading ahead of them from now on */
+	if(prefetcher_start(&snd.prefetch, &snd.src, snd.next_seq, snd.packet_size) < 0) {
+		report_error("Failed to start reader thread");
+	}
+	snd.start_usec = monotonic_usec();
+	if(verbosity >= VERBOSITY_PROGRESS) {
+		timer_arm(&snd.timers, &snd.stats_timer, STATS_INTERVAL_MS * 1000);
+	}
+	schedule_packets(&snd);
+
+	while(snd.is_last_ackd == 0) {
+		/* send the packets queued since the last wait, one system call per channel */
+		flush_channels(&snd);
+
+		/* wait for acknowledgements until the earliest retransmission is due */
+		if(event_loop_run_once(&loop, timer_wheel_next_timeout_ms(&snd.timers)) < 0) {
+			report_error("Error occurred in epoll_wait()");
+		}
+
+		/* retransmit the packets whose timers have expired */
+		if(snd.is_last_ackd == 0) {
+			timer_wheel_advance(&snd.timers);
+		}
+	}
+	uint64_t elapsed = monotonic_usec() - snd.start_usec;
+	timer_cancel(&snd.timers, &snd.stats_timer);
+	tracer_close(&tracer);
+	prefetcher_stop(&snd.prefetch);
+
+	for(i = 0; i < num_channels; i++) {
+		if(channels[i].state != CH_DOWN && channels[i].state != CH_DEAD) {
+			close(channels[i].conn.fd);
+			conn_destroy(&channels[i].conn);
+			impair_destroy(&channels[i].impair);
+		}
+		free(channels[i].slots);
+	}
+	free(snd.orphans);
+	pool_destroy(&snd.buffers);
+	free(snd.compressor);
+	event_loop_close(&loop);
+	int num_files = snd.src.num_entries;
+	source_close(&snd.src);
+
+	int is_verified = (snd.digest == snd.server_digest);
+	if(!is_verified) {
+		fprintf(stderr, "\nThe server received a different stream: CRC32C %08" PRIx32 " sent, %08" PRIx32 " received\n",
+			snd.digest, snd.server_digest);
+	} else if(is_tree) {
+		printf("\nTransfer of %d files completed successfully, CRC32C %08" PRIx32 "\n", num_files, snd.digest);
+	} else {
+		printf("\nFile transfer completed successfully, CRC32C %08" PRIx32 "\n", snd.digest);
+	}
+	qsort(snd.latencies, snd.num_latencies, sizeof(uint32_t), compare_latencies);
+	print_stats(&snd);
+	if(summary_path != NULL && write_summary(&snd, summary_path, elapsed) < 0) {
+		perror("Failed to write summary");
+	}
+	free(snd.latencies);
+
+	return is_verified ? 0 : 1;
+}
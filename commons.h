@@ -1,20 +1,47 @@
+#ifndef COMMONS_H
+#define COMMONS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
 #define SERVER_IP "127.0.0.1" /* Using loopback address for simplicity */
 
-#define PACKET_SIZE 100 /* in bytes */
-#define RETRANSMISSION_TIMEOUT 2 /* seconds */
-#define MAX_RETRIES 10 /* if exceeded, assume channel has been broken */
+#define DEFAULT_PACKET_SIZE 100 /* payload bytes per packet when not specified */
+#define MAX_PACKET_SIZE 65536 /* upper limit on the negotiated payload bytes per packet */
+#define RETRANSMISSION_TIMEOUT 2 /* seconds, used until a channel has measured its RTT */
+#define MIN_RTO_USEC 20000 /* lower bound of the adaptive retransmission timeout */
+#define MAX_RTO_USEC 60000000 /* upper bound of the retransmission timeout, incl. backoff */
+#define STALL_TIMEOUT_MS 2000 /* a channel that delivers nothing for this long is assumed broken */
+#define STALL_RTOS 3 /* ... or for this many retransmission timeouts, if longer */
+#define STALL_RETRANSMITS 3 /* ... and has retransmitted a packet at least this often meanwhile */
 
 #define SERVER_PORT 12500
 
-#define PACKET_DROP_RATE 10
+#define PACKET_DROP_RATE 10 /* percentage of data packets the server drops at random, unless specified */
 
 #define MAX_PENDING 5
 
+#define CLOSE_TIMEOUT_MS 2000 /* max wait for the peer to close a finished channel */
+
+#define DEFAULT_CHANNELS 2 /* no. of channels used when not specified */
+#define MAX_CHANNELS 64 /* upper limit on the no. of channels of a transfer */
+
+#define ACK_EVERY_PACKETS 8 /* max data packets acknowledged by one ACK */
+#define ACK_DELAY_USEC 1000 /* max time an ACK is held back to coalesce it with later ones */
+
+#define DEFAULT_WINDOW 1 /* packets in flight per channel, 1 -> stop and wait */
+#define MAX_WINDOW 64 /* upper limit on the packets in flight per channel */
+
+/* A packet as handled in memory, see protocol.h for its encoding on the wire */
 typedef struct packet {
-	size_t payload_size;
-	unsigned int seq_no;
-	unsigned int data_or_ack : 1; /* 0 -> data, 1-> ack */
-	unsigned int channel_no : 1; /* 0 or 1 according to the channel used */
-	unsigned int is_last : 1; /* 0 -> not last, 1 -> last */
-	char payload[PACKET_SIZE]; /* actual data payload */
-} Packet;
\ No newline at end of file
+	uint64_t seq_no; /* offset of the payload in the file */
+	uint32_t payload_size;
+	uint16_t channel_no; /* 0 to MAX_CHANNELS - 1 according to the channel used */
+	uint8_t type; /* PKT_DATA, PKT_ACK or PKT_HELLO */
+	uint8_t is_last; /* 0 -> not last, 1 -> last */
+	uint8_t is_compressed; /* the payload is an LZ4 block of the data */
+	uint32_t checksum; /* CRC32C of the payload of a data packet, or of the stream in the final ACK */
+	char* payload; /* actual data payload, not owned by the packet */
+} Packet;
+
+#endif
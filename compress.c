@@ -0,0 +1,232 @@
+#include <string.h>
+
+#include "compress.h"
+
+#define MIN_MATCH 4 /* shortest back-reference */
+#define LAST_LITERALS 5 /* a block ends with at least this many literals */
+#define MATCH_LIMIT 12 /* the last back-reference starts at least this far before the end */
+#define MAX_OFFSET 65535 /* furthest back-reference */
+#define SKIP_TRIGGER 6 /* the search steps up by a byte after every 2^SKIP_TRIGGER misses */
+
+/**
+ * Loads 4 bytes in host byte order
+ * @param p	The bytes
+ *
+ * @return The bytes as an integer
+ */
+static uint32_t load32(const unsigned char* p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+/**
+ * Hashes 4 bytes into the table of the match finder
+ * @param v	The bytes, as loaded by load32()
+ *
+ * @return The index in the table
+ */
+static uint32_t hash(uint32_t v) {
+	return (v * 2654435761U) >> (32 - COMPRESS_HASH_BITS);
+}
+
+/**
+ * Writes the extension of a length that did not fit in the 4 bits of the token
+ * @param out	The destination
+ * @param n		The length minus 15
+ *
+ * @return The end of the extension
+ */
+static unsigned char* put_length(unsigned char* out, uint32_t n) {
+	while(n >= 255) {
+		*out++ = 255;
+		n -= 255;
+	}
+	*out++ = n;
+	return out;
+}
+
+/**
+ * Writes a sequence: a run of literals followed by a back-reference, or by
+ * nothing at the end of the block
+ * @param out		The destination
+ * @param out_end	The end of the space of the destination
+ * @param literals	The literals
+ * @param num_lits	The no. of literals
+ * @param offset	The distance of the back-reference, 0 for none
+ * @param match_len	The length of the back-reference
+ *
+ * @return The end of the sequence, NULL if it does not fit
+ */
+static unsigned char* put_sequence(unsigned char* out, unsigned char* out_end, const unsigned char* literals,
+	uint32_t num_lits, uint32_t offset, uint32_t match_len) {
+	/* token, literal length, literals, offset and match length at worst */
+	size_t worst = 1 + num_lits / 255 + 1 + num_lits + 2 + match_len / 255 + 1;
+	if(worst > (size_t) (out_end - out)) {
+		return NULL;
+	}
+	unsigned char* token = out++;
+	*token = (num_lits < 15 ? num_lits : 15) << 4;
+	if(num_lits >= 15) {
+		out = put_length(out, num_lits - 15);
+	}
+	memcpy(out, literals, num_lits);
+	out += num_lits;
+	if(offset == 0) {
+		return out;
+	}
+
+	*out++ = offset & 0xff;
+	*out++ = offset >> 8;
+	match_len -= MIN_MATCH;
+	*token |= (match_len < 15) ? match_len : 15;
+	if(match_len >= 15) {
+		out = put_length(out, match_len - 15);
+	}
+	return out;
+}
+
+/**
+ * Initializes a compressor
+ * @param c	The compressor
+ */
+void compressor_init(Compressor* c) {
+	memset(c->table, 0, sizeof(c->table));
+	c->base = 1;
+}
+
+/**
+ * Compresses a block. The table of the match finder is not cleared between
+ * blocks, positions of earlier blocks are told apart by the base instead.
+ * @param c			The compressor
+ * @param src		The data
+ * @param len		The no. of bytes
+ * @param dst		The destination
+ * @param capacity	The space of the destination, the block is only
+ * 					compressed if it fits
+ *
+ * @return The size of the compressed block, 0 if it does not fit
+ */
+uint32_t compress_block(Compressor* c, const char* src, uint32_t len, char* dst, uint32_t capacity) {
+	const unsigned char* in = (const unsigned char*) src;
+	unsigned char* out = (unsigned char*) dst;
+	unsigned char* out_end = out + capacity;
+	if(c->base > UINT32_MAX - len - 1) {
+		compressor_init(c);
+	}
+
+	uint32_t anchor = 0; /* start of the pending literals */
+	if(len > MATCH_LIMIT) {
+		uint32_t pos = 0, misses = 0;
+		while(pos < len - MATCH_LIMIT) {
+			uint32_t seq = load32(in + pos);
+			uint32_t h = hash(seq);
+			uint32_t entry = c->table[h];
+			c->table[h] = c->base + pos;
+			uint32_t ref = entry - c->base;
+			if(entry < c->base || pos - ref > MAX_OFFSET || load32(in + ref) != seq) {
+				/* no match, step up the search in data that does not compress */
+				pos += 1 + (misses++ >> SKIP_TRIGGER);
+				continue;
+			}
+
+			uint32_t end = pos + MIN_MATCH;
+			while(end < len - LAST_LITERALS && in[end] == in[ref + end - pos]) {
+				end++;
+			}
+			out = put_sequence(out, out_end, in + anchor, pos - anchor, pos - ref, end - pos);
+			if(out == NULL) {
+				c->base += len;
+				return 0;
+			}
+			pos = anchor = end;
+			misses = 0;
+		}
+	}
+	out = put_sequence(out, out_end, in + anchor, len - anchor, 0, 0);
+	c->base += len;
+	if(out == NULL) {
+		return 0;
+	}
+	return out - (unsigned char*) dst;
+}
+
+/**
+ * Reads the extension of a length
+ * @param in		The source, moved past the extension
+ * @param in_end	The end of the source
+ * @param n			The length, incremented by the extension
+ *
+ * @return 0 on success, -1 if the source ends within the extension
+ */
+static int get_length(const unsigned char** in, const unsigned char* in_end, uint32_t* n) {
+	unsigned char b;
+	do {
+		if(*in >= in_end) {
+			return -1;
+		}
+		b = *(*in)++;
+		*n += b;
+	} while(b == 255);
+	return 0;
+}
+
+/**
+ * Decompresses a block, which may have been damaged or forged: nothing is
+ * read or written outside the buffers whatever it contains
+ * @param src		The compressed block
+ * @param len		The size of the compressed block
+ * @param dst		The destination
+ * @param capacity	The space of the destination
+ *
+ * @return The size of the decompressed data, -1 if the block is malformed
+ * 		   or does not fit
+ */
+int decompress_block(const char* src, uint32_t len, char* dst, uint32_t capacity) {
+	const unsigned char* in = (const unsigned char*) src;
+	const unsigned char* in_end = in + len;
+	unsigned char* out = (unsigned char*) dst;
+	unsigned char* out_end = out + capacity;
+	while(in < in_end) {
+		uint32_t token = *in++;
+		uint32_t num_lits = token >> 4;
+		if(num_lits == 15 && get_length(&in, in_end, &num_lits) < 0) {
+			return -1;
+		}
+		if(num_lits > (size_t) (in_end - in) || num_lits > (size_t) (out_end - out)) {
+			return -1;
+		}
+		memcpy(out, in, num_lits);
+		in += num_lits;
+		out += num_lits;
+		if(in == in_end) {
+			/* the last sequence has no back-reference */
+			break;
+		}
+
+		if(in_end - in < 2) {
+			return -1;
+		}
+		uint32_t offset = in[0] | (in[1] << 8);
+		in += 2;
+		uint32_t match_len = token & 15;
+		if(match_len == 15 && get_length(&in, in_end, &match_len) < 0) {
+			return -1;
+		}
+		match_len += MIN_MATCH;
+		if(offset == 0 || offset > (size_t) (out - (unsigned char*) dst) || match_len > (size_t) (out_end - out)) {
+			return -1;
+		}
+		const unsigned char* ref = out - offset;
+		if(offset >= match_len) {
+			memcpy(out, ref, match_len);
+		} else {
+			/* overlapping, repeats the last offset bytes */
+			for(uint32_t i = 0; i < match_len; i++) {
+				out[i] = ref[i];
+			}
+		}
+		out += match_len;
+	}
+	return out - (unsigned char*) dst;
+}
@@ -0,0 +1,24 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdint.h>
+
+#define COMPRESS_HASH_BITS 12 /* entries of the match finder's hash table, as a power of two */
+
+/*
+ * Compression of single packets in the LZ4 block format: a sequence of
+ * literal runs, each followed by a back-reference of at least 4 bytes to
+ * data up to 64 KiB before it in the same block. Every block stands alone,
+ * so packets can be decompressed in whatever order they arrive. The match
+ * finder is greedy with a single hash probe, favouring speed over ratio.
+ */
+typedef struct compressor {
+	uint32_t table[1 << COMPRESS_HASH_BITS]; /* latest position of every hash, offset by base */
+	uint32_t base; /* positions of earlier blocks lie below it */
+} Compressor;
+
+void compressor_init(Compressor* c);
+uint32_t compress_block(Compressor* c, const char* src, uint32_t len, char* dst, uint32_t capacity);
+int decompress_block(const char* src, uint32_t len, char* dst, uint32_t capacity);
+
+#endif
@@ -0,0 +1,265 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "conn.h"
+#include "protocol.h"
+
+/**
+ * Initializes a connection over a connected socket
+ * @param conn			The connection
+ * @param fd			The socket
+ * @param max_payload	Largest payload to be accepted from the peer
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int conn_init(Connection* conn, int fd, size_t max_payload) {
+	conn->fd = fd;
+	conn->max_payload = max_payload;
+
+	/* the buffer must be able to hold the largest packet in one piece */
+	conn->rx_cap = RX_BUFFER_SIZE;
+	if(conn->rx_cap < HEADER_SIZE + max_payload) {
+		conn->rx_cap = HEADER_SIZE + max_payload;
+	}
+	conn->rx_buf = malloc(conn->rx_cap);
+	conn->rx_head = conn->rx_tail = 0;
+
+	conn->tx_cap = TX_QUEUE_INITIAL;
+	conn->tx_queue = malloc(conn->tx_cap * sizeof(TxFrame));
+	conn->tx_head = conn->tx_count = 0;
+
+	conn->send_calls = conn->recv_calls = 0;
+
+	/* queued packets are sent in batches anyway, Nagle's algorithm would only hold back small ACKs */
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	return (conn->rx_buf == NULL || conn->tx_queue == NULL) ? -1 : 0;
+}
+
+/**
+ * Drops a packet from the head of the send queue, once sent or discarded
+ * @param conn	The connection
+ */
+static void retire_frame(Connection* conn) {
+	TxFrame* frame = &conn->tx_queue[conn->tx_head];
+	if(frame->pool != NULL) {
+		pool_release(frame->pool, frame->buf);
+	}
+	conn->tx_head = (conn->tx_head + 1) % conn->tx_cap;
+	conn->tx_count--;
+}
+
+/**
+ * Releases the buffers of a connection, and of the packets still queued, the
+ * socket is not closed
+ * @param conn	The connection
+ */
+void conn_destroy(Connection* conn) {
+	while(conn->tx_queue != NULL && conn->tx_count > 0) {
+		retire_frame(conn);
+	}
+	free(conn->rx_buf);
+	free(conn->tx_queue);
+	conn->rx_buf = NULL;
+	conn->tx_queue = NULL;
+}
+
+/**
+ * Receives the next packet from a connection. Bytes are read from the socket
+ * in as large pieces as the receive buffer allows and packets are parsed out
+ * of them, so one recv() usually yields many packets and a packet split
+ * across reads is completed by later ones. The payload of the packet stays
+ * valid until the next call.
+ * @param conn	The connection
+ * @param pkt	Output, the received packet
+ * 
+ * @return 1 if a packet was received, 0 if the socket has no more data for
+ * 		   now, -1 on failure (EPROTO for a malformed packet) and -2 if the
+ * 		   connection was closed by the peer
+ */
+int conn_recv_packet(Connection* conn, Packet* pkt) {
+	for(;;) {
+		size_t avail = conn->rx_tail - conn->rx_head;
+		size_t frame_len = HEADER_SIZE;
+		if(avail >= HEADER_SIZE) {
+			if(decode_header(conn->rx_buf + conn->rx_head, pkt) < 0 || pkt->payload_size > conn->max_payload) {
+				errno = EPROTO;
+				return -1;
+			}
+			frame_len = HEADER_SIZE + pkt->payload_size;
+			if(avail >= frame_len) {
+				/* a complete packet has been buffered */
+				pkt->payload = (char*) conn->rx_buf + conn->rx_head + HEADER_SIZE;
+				conn->rx_head += frame_len;
+				return 1;
+			}
+		}
+
+		/* make room for the rest of the packet at the end of the buffer */
+		if(avail == 0) {
+			conn->rx_head = conn->rx_tail = 0;
+		} else if(conn->rx_cap - conn->rx_head < frame_len) {
+			memmove(conn->rx_buf, conn->rx_buf + conn->rx_head, avail);
+			conn->rx_head = 0;
+			conn->rx_tail = avail;
+		}
+
+		ssize_t status = recv(conn->fd, conn->rx_buf + conn->rx_tail, conn->rx_cap - conn->rx_tail, 0);
+		conn->recv_calls++;
+		if(status < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		} else if(status == 0) {
+			return -2;
+		}
+		conn->rx_tail += status;
+	}
+}
+
+/**
+ * Queues a packet to be sent over a connection by the next conn_flush(), so
+ * that packets queued together go out in a single system call. A payload
+ * larger than INLINE_PAYLOAD_MAX is not copied (e.g. it is sent straight from
+ * a mapped file) and must stay valid until it has been sent.
+ * @param conn	The connection
+ * @param pkt	The packet to be sent
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int conn_queue_packet(Connection* conn, Packet* pkt) {
+	return conn_queue_buffer(conn, pkt, NULL, POOL_NONE);
+}
+
+/**
+ * Queues a packet like conn_queue_packet(), with its payload in a pool
+ * buffer. The queue holds a reference to the buffer until the packet has
+ * been sent, so the caller may release its own meanwhile.
+ * @param conn	The connection
+ * @param pkt	The packet to be sent
+ * @param pool	The pool of the buffer, NULL if the payload is not in one
+ * @param buf	The buffer holding the payload, or POOL_NONE
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int conn_queue_buffer(Connection* conn, Packet* pkt, BufferPool* pool, int buf) {
+	if(conn->tx_count == conn->tx_cap) {
+		/* grow the queue, unwrapping it into the new space */
+		TxFrame* queue = malloc(2 * conn->tx_cap * sizeof(TxFrame));
+		if(queue == NULL) {
+			return -1;
+		}
+		for(size_t i = 0; i < conn->tx_count; i++) {
+			queue[i] = conn->tx_queue[(conn->tx_head + i) % conn->tx_cap];
+		}
+		free(conn->tx_queue);
+		conn->tx_queue = queue;
+		conn->tx_cap *= 2;
+		conn->tx_head = 0;
+	}
+
+	TxFrame* frame = &conn->tx_queue[(conn->tx_head + conn->tx_count) % conn->tx_cap];
+	encode_header(pkt, frame->data);
+	if(pkt->payload_size <= INLINE_PAYLOAD_MAX) {
+		if(pkt->payload_size > 0) {
+			memcpy(frame->data + HEADER_SIZE, pkt->payload, pkt->payload_size);
+		}
+		frame->data_len = HEADER_SIZE + pkt->payload_size;
+		frame->payload = NULL;
+		frame->payload_len = 0;
+		frame->pool = NULL;
+	} else {
+		frame->data_len = HEADER_SIZE;
+		frame->payload = pkt->payload;
+		frame->payload_len = pkt->payload_size;
+		frame->pool = (buf != POOL_NONE) ? pool : NULL;
+		frame->buf = buf;
+		if(frame->pool != NULL) {
+			pool_ref(pool, buf);
+		}
+	}
+	frame->sent = 0;
+	conn->tx_count++;
+	return 0;
+}
+
+/**
+ * Queues a packet to be sent over a connection and sends as much of the
+ * queue as the socket accepts right away. The rest is sent by conn_flush()
+ * once the socket becomes writable.
+ * @param conn	The connection
+ * @param pkt	The packet to be sent
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int conn_send_packet(Connection* conn, Packet* pkt) {
+	if(conn_queue_packet(conn, pkt) < 0) {
+		return -1;
+	}
+	return conn_flush(conn);
+}
+
+/**
+ * Sends the queued packets until the queue is empty or the socket's send
+ * buffer is full. The unsent parts of up to TX_BATCH_IOV / 2 packets are
+ * gathered into each sendmsg(), a partially sent packet is resumed where it
+ * stopped.
+ * @param conn	The connection
+ * 
+ * @return 0 on success (even if packets remain queued), -1 on failure
+ */
+int conn_flush(Connection* conn) {
+	while(conn->tx_count > 0) {
+		/* the parts of the queued packets not sent yet */
+		struct iovec iov[TX_BATCH_IOV];
+		int num_iov = 0;
+		for(size_t i = 0; i < conn->tx_count && num_iov + 2 <= TX_BATCH_IOV; i++) {
+			TxFrame* frame = &conn->tx_queue[(conn->tx_head + i) % conn->tx_cap];
+			if(frame->sent < frame->data_len) {
+				iov[num_iov].iov_base = frame->data + frame->sent;
+				iov[num_iov].iov_len = frame->data_len - frame->sent;
+				num_iov++;
+			}
+			if(frame->payload_len > 0) {
+				size_t payload_sent = (frame->sent > frame->data_len) ? frame->sent - frame->data_len : 0;
+				iov[num_iov].iov_base = (char*) frame->payload + payload_sent;
+				iov[num_iov].iov_len = frame->payload_len - payload_sent;
+				num_iov++;
+			}
+		}
+
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = num_iov;
+		ssize_t status = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+		conn->send_calls++;
+		if(status < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		}
+
+		/* retire the packets sent completely */
+		size_t sent = status;
+		while(sent > 0) {
+			TxFrame* frame = &conn->tx_queue[conn->tx_head];
+			size_t remaining = frame->data_len + frame->payload_len - frame->sent;
+			if(sent < remaining) {
+				frame->sent += sent;
+				break;
+			}
+			sent -= remaining;
+			retire_frame(conn);
+		}
+	}
+	return 0;
+}
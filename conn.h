@@ -0,0 +1,61 @@
+#ifndef CONN_H
+#define CONN_H
+
+#include <stddef.h>
+
+#include "commons.h"
+#include "protocol.h"
+#include "pool.h"
+
+#define RX_BUFFER_SIZE (256 * 1024) /* bytes received per connection before parsing */
+#define INLINE_PAYLOAD_MAX 64 /* payloads up to this size are copied into the send queue */
+#define TX_QUEUE_INITIAL 16 /* initial capacity of the send queue, in packets */
+#define TX_BATCH_IOV 64 /* max pieces of queued packets gathered into one sendmsg() */
+
+/*
+ * A packet waiting in the send queue. Its header (and a small payload) is
+ * stored in the queue, a larger payload is sent from where it is and must
+ * stay valid until the packet has been sent. A payload in a pool buffer is
+ * kept valid by a reference the frame holds.
+ */
+typedef struct tx_frame {
+	unsigned char data[HEADER_SIZE + INLINE_PAYLOAD_MAX];
+	size_t data_len;
+	const char* payload;
+	size_t payload_len;
+	size_t sent; /* bytes of the packet already sent */
+	BufferPool* pool; /* of the buffer holding the payload, NULL if none */
+	int buf;
+} TxFrame;
+
+/* A non-blocking channel connection carrying variable-length packets */
+typedef struct connection {
+	int fd;
+	size_t max_payload; /* largest payload accepted from the peer */
+
+	/* received bytes, [rx_head, rx_tail) have not been parsed into packets yet */
+	unsigned char* rx_buf;
+	size_t rx_cap;
+	size_t rx_head;
+	size_t rx_tail;
+
+	/* circular queue of packets waiting to be sent */
+	TxFrame* tx_queue;
+	size_t tx_cap;
+	size_t tx_head;
+	size_t tx_count;
+
+	/* system calls made on the socket */
+	unsigned long send_calls;
+	unsigned long recv_calls;
+} Connection;
+
+int conn_init(Connection* conn, int fd, size_t max_payload);
+void conn_destroy(Connection* conn);
+int conn_recv_packet(Connection* conn, Packet* pkt);
+int conn_queue_packet(Connection* conn, Packet* pkt);
+int conn_queue_buffer(Connection* conn, Packet* pkt, BufferPool* pool, int buf);
+int conn_send_packet(Connection* conn, Packet* pkt);
+int conn_flush(Connection* conn);
+
+#endif
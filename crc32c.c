@@ -0,0 +1,286 @@
+#include <string.h>
+#include <pthread.h>
+
+#include "crc32c.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define HAVE_SSE42_CRC
+#elif defined(__aarch64__) && defined(__linux__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define HAVE_ARMV8_CRC
+#endif
+
+#define STRIPE 256 /* bytes per stream of the interleaved hardware loop */
+
+static uint32_t table[8][256]; /* table[k][b]: CRC of byte b followed by k zero bytes */
+static uint32_t x2n_table[32]; /* x^(2^n) modulo the polynomial */
+static uint32_t stripe_table[2][4][256]; /* moves a CRC past 1 and 2 stripes, a byte of it at a time */
+static uint32_t (*update)(uint32_t crc, const unsigned char* p, size_t len);
+static const char* impl_name;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+/**
+ * Updates a CRC with a buffer, 8 bytes at a time through the tables
+ * @param crc	The CRC so far, not inverted
+ * @param p		The buffer
+ * @param len	The length of the buffer
+ *
+ * @return The updated CRC
+ */
+static uint32_t update_table(uint32_t crc, const unsigned char* p, size_t len) {
+	while(len >= 8) {
+		crc ^= p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+		crc = table[7][crc & 0xff] ^ table[6][(crc >> 8) & 0xff] ^ table[5][(crc >> 16) & 0xff] ^ table[4][crc >> 24] ^
+			table[3][p[4]] ^ table[2][p[5]] ^ table[1][p[6]] ^ table[0][p[7]];
+		p += 8;
+		len -= 8;
+	}
+	while(len > 0) {
+		crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+	return crc;
+}
+
+/**
+ * Moves a CRC past 1 or 2 stripes of zero bytes
+ * @param crc		The CRC, not inverted
+ * @param stripes	1 or 2
+ *
+ * @return The CRC of the data followed by the zero bytes
+ */
+static inline uint32_t shift_stripes(uint32_t crc, int stripes) {
+	uint32_t (*t)[256] = stripe_table[stripes - 1];
+	return t[0][crc & 0xff] ^ t[1][(crc >> 8) & 0xff] ^ t[2][(crc >> 16) & 0xff] ^ t[3][crc >> 24];
+}
+
+#ifdef HAVE_SSE42_CRC
+/**
+ * Updates a CRC with a buffer through the CRC32 instruction of SSE 4.2. The
+ * instruction has a latency of several cycles but issues every cycle, so
+ * three stripes are checksummed at once and their CRCs combined.
+ * @param crc	The CRC so far, not inverted
+ * @param p		The buffer
+ * @param len	The length of the buffer
+ *
+ * @return The updated CRC
+ */
+__attribute__((target("sse4.2"))) static uint32_t update_sse42(uint32_t crc, const unsigned char* p, size_t len) {
+#ifdef __x86_64__
+	while(len >= 3 * STRIPE) {
+		uint64_t crc0 = crc, crc1 = 0, crc2 = 0;
+		for(const unsigned char* end = p + STRIPE; p < end; p += 8) {
+			uint64_t word0, word1, word2;
+			memcpy(&word0, p, 8);
+			memcpy(&word1, p + STRIPE, 8);
+			memcpy(&word2, p + 2 * STRIPE, 8);
+			crc0 = _mm_crc32_u64(crc0, word0);
+			crc1 = _mm_crc32_u64(crc1, word1);
+			crc2 = _mm_crc32_u64(crc2, word2);
+		}
+		crc = shift_stripes(crc0, 2) ^ shift_stripes(crc1, 1) ^ crc2;
+		p += 2 * STRIPE;
+		len -= 3 * STRIPE;
+	}
+	uint64_t crc64 = crc;
+	while(len >= 8) {
+		uint64_t word;
+		memcpy(&word, p, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+		p += 8;
+		len -= 8;
+	}
+	crc = crc64;
+#endif
+	while(len >= 4) {
+		uint32_t word;
+		memcpy(&word, p, 4);
+		crc = _mm_crc32_u32(crc, word);
+		p += 4;
+		len -= 4;
+	}
+	while(len > 0) {
+		crc = _mm_crc32_u8(crc, *p++);
+		len--;
+	}
+	return crc;
+}
+#endif
+
+#ifdef HAVE_ARMV8_CRC
+/**
+ * Updates a CRC with a buffer through the CRC32C instructions of ARMv8,
+ * three stripes at once like update_sse42()
+ * @param crc	The CRC so far, not inverted
+ * @param p		The buffer
+ * @param len	The length of the buffer
+ *
+ * @return The updated CRC
+ */
+__attribute__((target("+crc"))) static uint32_t update_armv8(uint32_t crc, const unsigned char* p, size_t len) {
+	while(len >= 3 * STRIPE) {
+		uint32_t crc0 = crc, crc1 = 0, crc2 = 0;
+		for(const unsigned char* end = p + STRIPE; p < end; p += 8) {
+			uint64_t word0, word1, word2;
+			memcpy(&word0, p, 8);
+			memcpy(&word1, p + STRIPE, 8);
+			memcpy(&word2, p + 2 * STRIPE, 8);
+			crc0 = __crc32cd(crc0, word0);
+			crc1 = __crc32cd(crc1, word1);
+			crc2 = __crc32cd(crc2, word2);
+		}
+		crc = shift_stripes(crc0, 2) ^ shift_stripes(crc1, 1) ^ crc2;
+		p += 2 * STRIPE;
+		len -= 3 * STRIPE;
+	}
+	while(len >= 8) {
+		uint64_t word;
+		memcpy(&word, p, 8);
+		crc = __crc32cd(crc, word);
+		p += 8;
+		len -= 8;
+	}
+	while(len > 0) {
+		crc = __crc32cb(crc, *p++);
+		len--;
+	}
+	return crc;
+}
+#endif
+
+/**
+ * Multiplies two polynomials modulo the CRC polynomial, both bit-reflected
+ * @param a	The first polynomial
+ * @param b	The second polynomial
+ *
+ * @return The product
+ */
+static uint32_t multmodp(uint32_t a, uint32_t b) {
+	uint32_t m = (uint32_t) 1 << 31;
+	uint32_t p = 0;
+	for(;;) {
+		if(a & m) {
+			p ^= b;
+			if((a & (m - 1)) == 0) {
+				break;
+			}
+		}
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+	}
+	return p;
+}
+
+/**
+ * Computes x^(8 len) modulo the polynomial, the operator of crc32c_shift()
+ * @param len	The no. of bytes
+ *
+ * @return The operator
+ */
+static uint32_t x8nmodp(uint64_t len) {
+	uint32_t p = (uint32_t) 1 << 31; /* x^0 */
+	for(int n = 3; len > 0; len >>= 1, n++) {
+		if(len & 1) {
+			p = multmodp(x2n_table[n & 31], p);
+		}
+	}
+	return p;
+}
+
+/**
+ * Builds the tables and picks the fastest implementation the CPU supports
+ */
+static void init(void) {
+	for(uint32_t b = 0; b < 256; b++) {
+		uint32_t crc = b;
+		for(int i = 0; i < 8; i++) {
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		}
+		table[0][b] = crc;
+	}
+	for(uint32_t b = 0; b < 256; b++) {
+		for(int k = 1; k < 8; k++) {
+			table[k][b] = table[0][table[k - 1][b] & 0xff] ^ (table[k - 1][b] >> 8);
+		}
+	}
+
+	/* x^1, then squared over and over */
+	x2n_table[0] = (uint32_t) 1 << 30;
+	for(int n = 1; n < 32; n++) {
+		x2n_table[n] = multmodp(x2n_table[n - 1], x2n_table[n - 1]);
+	}
+	for(int i = 0; i < 2; i++) {
+		uint32_t op = x8nmodp((uint64_t) (i + 1) * STRIPE);
+		for(int k = 0; k < 4; k++) {
+			for(uint32_t b = 0; b < 256; b++) {
+				stripe_table[i][k][b] = multmodp(op, b << (8 * k));
+			}
+		}
+	}
+
+	update = update_table;
+	impl_name = "table";
+#ifdef HAVE_SSE42_CRC
+	if(__builtin_cpu_supports("sse4.2")) {
+		update = update_sse42;
+		impl_name = "SSE 4.2";
+	}
+#endif
+#ifdef HAVE_ARMV8_CRC
+	if(getauxval(AT_HWCAP) & HWCAP_CRC32) {
+		update = update_armv8;
+		impl_name = "ARMv8";
+	}
+#endif
+}
+
+/**
+ * Computes the CRC32C of a buffer, or continues that of the data before it
+ * @param crc	0, or the CRC32C of the data preceding the buffer
+ * @param data	The buffer
+ * @param len	The length of the buffer
+ *
+ * @return The CRC32C
+ */
+uint32_t crc32c(uint32_t crc, const void* data, size_t len) {
+	pthread_once(&once, init);
+	return ~update(~crc, data, len);
+}
+
+/**
+ * Computes the operator combining the CRC32C of some data with that of the
+ * len bytes following it, see crc32c_combine(). It only depends on the
+ * length, so it can be computed once for parts of equal length.
+ * @param len	The length of the second part
+ *
+ * @return The operator, x^(8 len) modulo the polynomial
+ */
+uint32_t crc32c_shift(uint64_t len) {
+	pthread_once(&once, init);
+	return x8nmodp(len);
+}
+
+/**
+ * Combines the CRC32Cs of two consecutive parts into the CRC32C of both
+ * @param crc1	The CRC32C of the first part
+ * @param crc2	The CRC32C of the second part
+ * @param shift	crc32c_shift() of the length of the second part
+ *
+ * @return The CRC32C of the first part followed by the second
+ */
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint32_t shift) {
+	return multmodp(shift, crc1) ^ crc2;
+}
+
+/**
+ * Names the implementation in use, for the statistics
+ *
+ * @return "SSE 4.2", "ARMv8" or "table"
+ */
+const char* crc32c_impl(void) {
+	pthread_once(&once, init);
+	return impl_name;
+}
@@ -0,0 +1,20 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CRC32C_POLY 0x82f63b78 /* Castagnoli polynomial, bit-reflected */
+
+/*
+ * CRC32C (Castagnoli) as used by iSCSI and SCTP, with the CRC instructions of
+ * SSE 4.2 or ARMv8 where the CPU has them and a table otherwise. Checksums of
+ * consecutive parts combine into the checksum of the whole, so a stream can
+ * be checksummed a packet at a time, in any order the packets are completed.
+ */
+uint32_t crc32c(uint32_t crc, const void* data, size_t len);
+uint32_t crc32c_shift(uint64_t len);
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint32_t shift);
+const char* crc32c_impl(void);
+
+#endif
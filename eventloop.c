@@ -0,0 +1,86 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "eventloop.h"
+
+/**
+ * Puts a descriptor into non-blocking mode
+ * @param fd	The descriptor
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int make_nonblocking(int fd) {
+	int flags = fcntl(fd, F_GETFL, 0);
+	if(flags < 0) {
+		return -1;
+	}
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/**
+ * Creates the epoll instance backing an event loop
+ * @param loop	The event loop to be initialized
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int event_loop_init(EventLoop* loop) {
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	return (loop->epfd < 0) ? -1 : 0;
+}
+
+/**
+ * Starts watching a descriptor. The source must stay valid until it is
+ * removed from the loop.
+ * @param loop		The event loop
+ * @param src		The descriptor along with its handler
+ * @param events	The epoll events of interest (e.g. EPOLLIN | EPOLLET)
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int event_loop_add(EventLoop* loop, EventSource* src, uint32_t events) {
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.ptr = src;
+	return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, src->fd, &ev);
+}
+
+/**
+ * Stops watching a descriptor
+ * @param loop	The event loop
+ * @param src	The source registered earlier
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int event_loop_del(EventLoop* loop, EventSource* src) {
+	return epoll_ctl(loop->epfd, EPOLL_CTL_DEL, src->fd, NULL);
+}
+
+/**
+ * Waits for events and dispatches them to the handlers of the ready sources
+ * @param loop			The event loop
+ * @param timeout_ms	Max time to wait in milliseconds, -1 to wait forever
+ * 
+ * @return The no. of events dispatched (0 on timeout), -1 on failure
+ */
+int event_loop_run_once(EventLoop* loop, int timeout_ms) {
+	struct epoll_event events[MAX_EVENTS];
+	int num_ready = epoll_wait(loop->epfd, events, MAX_EVENTS, timeout_ms);
+	if(num_ready < 0) {
+		/* a signal interrupting the wait is not an error */
+		return (errno == EINTR) ? 0 : -1;
+	}
+	for(int i = 0; i < num_ready; i++) {
+		EventSource* src = events[i].data.ptr;
+		src->handler(src->fd, events[i].events, src->arg);
+	}
+	return num_ready;
+}
+
+/**
+ * Releases the epoll instance of an event loop
+ * @param loop	The event loop
+ */
+void event_loop_close(EventLoop* loop) {
+	close(loop->epfd);
+}
@@ -0,0 +1,36 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#define MAX_EVENTS 64 /* max events handled per wait on the event loop */
+
+/**
+ * Callback invoked when a descriptor registered with the event loop is ready
+ * @param fd		The ready descriptor
+ * @param events	The epoll events reported for the descriptor
+ * @param arg		The argument registered along with the descriptor
+ */
+typedef void (*event_handler)(int fd, uint32_t events, void* arg);
+
+/* A descriptor watched by the event loop, embedded by the owner of the fd */
+typedef struct event_source {
+	int fd;
+	event_handler handler;
+	void* arg;
+} EventSource;
+
+typedef struct event_loop {
+	int epfd;
+} EventLoop;
+
+int make_nonblocking(int fd);
+
+int event_loop_init(EventLoop* loop);
+int event_loop_add(EventLoop* loop, EventSource* src, uint32_t events);
+int event_loop_del(EventLoop* loop, EventSource* src);
+int event_loop_run_once(EventLoop* loop, int timeout_ms);
+void event_loop_close(EventLoop* loop);
+
+#endif
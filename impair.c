@@ -0,0 +1,422 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "impair.h"
+
+/**
+ * Sets a configuration that impairs nothing
+ * @param cfg	The configuration
+ */
+void impair_config_init(ImpairConfig* cfg) {
+	memset(cfg, 0, sizeof(ImpairConfig));
+	cfg->loss_bad = 1;
+	cfg->p_good = 1;
+	cfg->burst = DEFAULT_BURST_BYTES;
+}
+
+/**
+ * Parses a duration
+ * @param str	The duration, in ms unless followed by us, ms or s
+ * @param usec	Output, the duration in micro-seconds
+ *
+ * @return 0 on success, -1 if it is invalid
+ */
+static int parse_duration(const char* str, uint64_t* usec) {
+	char* end;
+	double value = strtod(str, &end);
+	double scale = 1000;
+	if(strcmp(end, "us") == 0) {
+		scale = 1;
+	} else if(strcmp(end, "s") == 0) {
+		scale = 1000000;
+	} else if(*end != '\0' && strcmp(end, "ms") != 0) {
+		return -1;
+	}
+	if(end == str || value < 0 || value * scale > MAX_RTO_USEC) {
+		return -1;
+	}
+	*usec = (uint64_t) (value * scale);
+	return 0;
+}
+
+/**
+ * Parses a probability
+ * @param str			The probability, a percentage optionally followed by %
+ * @param probability	Output, the probability between 0 and 1
+ *
+ * @return 0 on success, -1 if it is invalid
+ */
+static int parse_percentage(const char* str, double* probability) {
+	char* end;
+	double value = strtod(str, &end);
+	if(end == str || (*end != '\0' && strcmp(end, "%") != 0) || value < 0 || value > 100) {
+		return -1;
+	}
+	*probability = value / 100;
+	return 0;
+}
+
+/**
+ * Parses a no. of bytes
+ * @param str	The no., optionally followed by K, M or G for multiples of 1024
+ * @param bytes	Output, the no. of bytes
+ *
+ * @return 0 on success, -1 if it is invalid
+ */
+static int parse_bytes(const char* str, uint64_t* bytes) {
+	char* end;
+	double value = strtod(str, &end);
+	double scale = 1;
+	if(*end == 'K' || *end == 'k') {
+		scale = 1024;
+	} else if(*end == 'M' || *end == 'm') {
+		scale = 1024 * 1024;
+	} else if(*end == 'G' || *end == 'g') {
+		scale = 1024 * 1024 * 1024;
+	}
+	if(scale > 1) {
+		end++;
+	}
+	if(end == str || *end != '\0' || value < 0 || value * scale > (double) UINT64_MAX / 2) {
+		return -1;
+	}
+	*bytes = (uint64_t) (value * scale);
+	return 0;
+}
+
+/**
+ * Applies a setting to a configuration
+ * @param cfg	The configuration
+ * @param key	The name of the setting
+ * @param value	The value
+ *
+ * @return 0 on success, -1 if the setting is unknown or its value invalid
+ */
+static int apply_setting(ImpairConfig* cfg, const char* key, const char* value) {
+	if(strcmp(key, "delay") == 0) {
+		return parse_duration(value, &cfg->delay_usec);
+	} else if(strcmp(key, "jitter") == 0) {
+		return parse_duration(value, &cfg->jitter_usec);
+	} else if(strcmp(key, "loss") == 0) {
+		return parse_percentage(value, &cfg->loss);
+	} else if(strcmp(key, "loss_bad") == 0) {
+		return parse_percentage(value, &cfg->loss_bad);
+	} else if(strcmp(key, "p_bad") == 0) {
+		return parse_percentage(value, &cfg->p_bad);
+	} else if(strcmp(key, "p_good") == 0) {
+		return parse_percentage(value, &cfg->p_good);
+	} else if(strcmp(key, "reorder") == 0) {
+		return parse_percentage(value, &cfg->reorder);
+	} else if(strcmp(key, "duplicate") == 0) {
+		return parse_percentage(value, &cfg->duplicate);
+	} else if(strcmp(key, "corrupt") == 0) {
+		return parse_percentage(value, &cfg->corrupt);
+	} else if(strcmp(key, "rate") == 0) {
+		return parse_bytes(value, &cfg->rate);
+	} else if(strcmp(key, "burst") == 0) {
+		return parse_bytes(value, &cfg->burst);
+	} else if(strcmp(key, "seed") == 0) {
+		char* end;
+		cfg->seed = strtoull(value, &end, 0);
+		return (end == value || *end != '\0') ? -1 : 0;
+	}
+	return -1;
+}
+
+/**
+ * Parses an impairment specification of the form
+ * [channel:]key=value[,key=value...] and applies it to the configuration of
+ * the given channel, or of every channel without a channel prefix. The keys
+ * are delay and jitter (ms, us or s), loss, loss_bad, p_bad, p_good, reorder,
+ * duplicate and corrupt (%), rate (bytes per second) and burst (bytes), with K, M or
+ * G suffixes, and seed.
+ * @param configs		The configurations, one per channel
+ * @param num_configs	The no. of configurations
+ * @param spec			The specification
+ *
+ * @return 0 on success, -1 if it is invalid (errno is set to EINVAL)
+ */
+int impair_config_parse(ImpairConfig* configs, int num_configs, const char* spec) {
+	int first = 0, last = num_configs - 1;
+	char* end;
+	long channel_no = strtol(spec, &end, 10);
+	if(end != spec && *end == ':') {
+		if(channel_no < 0 || channel_no >= num_configs) {
+			errno = EINVAL;
+			return -1;
+		}
+		first = last = channel_no;
+		spec = end + 1;
+	}
+
+	char* copy = strdup(spec);
+	if(copy == NULL) {
+		return -1;
+	}
+	int status = 0;
+	char* saveptr;
+	for(char* setting = strtok_r(copy, ",", &saveptr); setting != NULL && status == 0;
+		setting = strtok_r(NULL, ",", &saveptr)) {
+		char* value = strchr(setting, '=');
+		if(value == NULL) {
+			status = -1;
+			break;
+		}
+		*value++ = '\0';
+		for(int i = first; i <= last && status == 0; i++) {
+			status = apply_setting(&configs[i], setting, value);
+		}
+	}
+	free(copy);
+	if(status < 0) {
+		errno = EINVAL;
+	}
+	return status;
+}
+
+/**
+ * Checks whether a configuration impairs anything
+ * @param cfg	The configuration
+ *
+ * @return 1 if it does, 0 otherwise
+ */
+int impair_is_active(const ImpairConfig* cfg) {
+	return cfg->delay_usec > 0 || cfg->jitter_usec > 0 || cfg->loss > 0 || (cfg->p_bad > 0 && cfg->loss_bad > 0) ||
+		cfg->reorder > 0 || cfg->duplicate > 0 || cfg->corrupt > 0 || cfg->rate > 0;
+}
+
+/**
+ * Starts impairing the packets received on a channel
+ * @param im			The impairer
+ * @param cfg			The configuration, which must outlive the impairer
+ * @param channel_no	The channel, added to the seed of the configuration
+ * @param timers		The timer wheel of the caller
+ * @param handler		Called when held packets become due, the caller
+ * 						should then receive again
+ * @param arg			The argument of the handler
+ */
+void impair_init(Impairer* im, const ImpairConfig* cfg, int channel_no, TimerWheel* timers, timer_handler handler,
+	void* arg) {
+	memset(im, 0, sizeof(Impairer));
+	im->cfg = cfg;
+	im->channel_no = channel_no;
+	im->is_active = impair_is_active(cfg);
+	im->timers = timers;
+	timer_init(&im->timer, handler, arg);
+
+	/* splitmix64 of the seed, the state of xorshift must not be 0 */
+	uint64_t z = cfg->seed + channel_no + 0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	im->rng = (z ^ (z >> 31)) | 1;
+}
+
+/**
+ * Generates the next random no. of an impairer (xorshift64*)
+ * @param im	The impairer
+ *
+ * @return A random no. between 0 (inclusive) and 1 (exclusive)
+ */
+static double next_random(Impairer* im) {
+	im->rng ^= im->rng >> 12;
+	im->rng ^= im->rng << 25;
+	im->rng ^= im->rng >> 27;
+	return ((im->rng * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * Decides whether the next packet is lost, moving the burst loss model
+ * (Gilbert-Elliott) between its good and bad states first
+ * @param im	The impairer
+ *
+ * @return 1 if the packet is lost, 0 otherwise
+ */
+static int is_lost(Impairer* im) {
+	const ImpairConfig* cfg = im->cfg;
+	if(cfg->p_bad > 0) {
+		if(im->is_bad) {
+			im->is_bad = !(next_random(im) < cfg->p_good);
+		} else {
+			im->is_bad = (next_random(im) < cfg->p_bad);
+		}
+	}
+	double loss = im->is_bad ? cfg->loss_bad : cfg->loss;
+	return loss > 0 && next_random(im) < loss;
+}
+
+/**
+ * Decides when a packet is delivered: once the bandwidth limit lets it pass
+ * and its latency has elapsed
+ * @param im	The impairer
+ * @param pkt	The packet
+ * @param now	The current monotonic time in micro-seconds
+ *
+ * @return The monotonic time of delivery in micro-seconds
+ */
+static uint64_t release_time(Impairer* im, Packet* pkt, uint64_t now) {
+	const ImpairConfig* cfg = im->cfg;
+	uint64_t release = now;
+	if(cfg->rate > 0) {
+		/* token bucket as a virtual scheduling time, which may run ahead of now by the burst */
+		double burst_usec = cfg->burst * 1e6 / cfg->rate;
+		if(im->tat_usec < now) {
+			im->tat_usec = now;
+		}
+		if(im->tat_usec - burst_usec > now) {
+			release = (uint64_t) (im->tat_usec - burst_usec);
+		}
+		im->tat_usec += (HEADER_SIZE + pkt->payload_size) * 1e6 / cfg->rate;
+	}
+
+	if(cfg->reorder > 0 && next_random(im) < cfg->reorder) {
+		im->reordered++;
+		return release;
+	}
+	uint64_t latency = cfg->delay_usec;
+	if(cfg->jitter_usec > 0) {
+		double offset = (2 * next_random(im) - 1) * cfg->jitter_usec;
+		latency = (offset < -(double) latency) ? 0 : (uint64_t) (latency + offset);
+	}
+	release += latency;
+	if(release < im->last_release_usec) {
+		release = im->last_release_usec;
+	}
+	im->last_release_usec = release;
+	return release;
+}
+
+/**
+ * Holds a copy of a packet until its delivery time
+ * @param im		The impairer
+ * @param pkt		The packet
+ * @param release	The monotonic time of delivery in micro-seconds
+ *
+ * @return 0 on success, -1 if there is no memory left
+ */
+static int hold(Impairer* im, Packet* pkt, uint64_t release) {
+	DelayedPacket* d = malloc(sizeof(DelayedPacket) + pkt->payload_size);
+	if(d == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	d->release_usec = release;
+	d->pkt = *pkt;
+	d->pkt.payload = (char*) (d + 1);
+	memcpy(d->pkt.payload, pkt->payload, pkt->payload_size);
+
+	/* packets mostly arrive in the order of delivery, so look at the tail first */
+	if(im->held == NULL || release >= im->held_tail->release_usec) {
+		d->next = NULL;
+		if(im->held == NULL) {
+			im->held = d;
+		} else {
+			im->held_tail->next = d;
+		}
+		im->held_tail = d;
+		return 0;
+	}
+	DelayedPacket** link = &im->held;
+	while((*link)->release_usec <= release) {
+		link = &(*link)->next;
+	}
+	d->next = *link;
+	*link = d;
+	return 0;
+}
+
+/**
+ * Receives the next packet of a channel that is due, as conn_recv_packet()
+ * does. All the packets available on the connection are taken in and either
+ * lost, held back or handed over right away. The payload of a packet stays
+ * valid until the next call.
+ * @param im	The impairer
+ * @param conn	The connection of the channel
+ * @param pkt	Output, the packet
+ *
+ * @return 1 if a packet is due, 0 if none is, -1 on failure and -2 if the
+ * 		   connection has been closed, once all the packets held back have
+ * 		   been delivered
+ */
+int impair_recv_packet(Impairer* im, Connection* conn, Packet* pkt) {
+	if(!im->is_active) {
+		return conn_recv_packet(conn, pkt);
+	}
+	free(im->delivered);
+	im->delivered = NULL;
+
+	uint64_t now = monotonic_usec();
+	for(;;) {
+		if(im->held != NULL && im->held->release_usec <= now) {
+			im->delivered = im->held;
+			im->held = im->held->next;
+			*pkt = im->delivered->pkt;
+			return 1;
+		}
+		if(im->conn_status != 0) {
+			break;
+		}
+
+		Packet received;
+		int status = conn_recv_packet(conn, &received);
+		if(status == 0) {
+			break;
+		} else if(status < 0) {
+			im->conn_status = status;
+			break;
+		}
+		if(is_lost(im)) {
+			im->dropped++;
+			trace_record(im->trace, TRACE_DROP, im->session_id, im->channel_no, received.seq_no, received.payload_size,
+				received.is_last);
+			continue;
+		}
+		if(im->cfg->corrupt > 0 && received.type == PKT_DATA && received.payload_size > 0 &&
+			next_random(im) < im->cfg->corrupt) {
+			/* the payload lies in the receive buffer of the connection, which may be altered */
+			uint64_t bit = (uint64_t) (next_random(im) * received.payload_size * 8);
+			received.payload[bit / 8] ^= 1 << (bit % 8);
+			im->corrupted++;
+		}
+		int copies = 1;
+		if(im->cfg->duplicate > 0 && next_random(im) < im->cfg->duplicate) {
+			im->duplicated++;
+			copies = 2;
+		}
+		uint64_t release = release_time(im, &received, now);
+		if(im->held == NULL && release <= now && copies == 1) {
+			/* due right away, no need for a copy */
+			*pkt = received;
+			return 1;
+		}
+		for(int i = 0; i < copies; i++) {
+			if(hold(im, &received, release) < 0) {
+				return -1;
+			}
+		}
+	}
+
+	if(im->held != NULL) {
+		timer_arm(im->timers, &im->timer, im->held->release_usec - now);
+		return 0;
+	}
+	timer_cancel(im->timers, &im->timer);
+	return im->conn_status;
+}
+
+/**
+ * Discards the packets held back and stops the timer
+ * @param im	The impairer
+ */
+void impair_destroy(Impairer* im) {
+	if(im->timers != NULL) {
+		timer_cancel(im->timers, &im->timer);
+	}
+	while(im->held != NULL) {
+		DelayedPacket* d = im->held;
+		im->held = d->next;
+		free(d);
+	}
+	free(im->delivered);
+	im->delivered = NULL;
+}
@@ -0,0 +1,78 @@
+#ifndef IMPAIR_H
+#define IMPAIR_H
+
+#include <stdint.h>
+
+#include "commons.h"
+#include "conn.h"
+#include "timer.h"
+#include "trace.h"
+
+#define DEFAULT_BURST_BYTES (64 * 1024) /* bucket size of a bandwidth limit, unless specified */
+
+/* Impairments of the packets received on one channel */
+typedef struct impair_config {
+	uint64_t delay_usec; /* fixed latency */
+	uint64_t jitter_usec; /* latency varies uniformly by up to this much either way */
+	double loss; /* probability of a loss, in the good state of a burst loss model */
+	double loss_bad; /* probability of a loss in the bad state */
+	double p_bad; /* probability of moving from the good to the bad state, 0 for uniform loss */
+	double p_good; /* probability of moving from the bad back to the good state */
+	double reorder; /* probability of a packet skipping the latency and overtaking earlier ones */
+	double duplicate; /* probability of a packet being delivered twice */
+	double corrupt; /* probability of a bit of the payload of a data packet being flipped */
+	uint64_t rate; /* bandwidth limit in bytes per second, 0 for none */
+	uint64_t burst; /* bytes that may pass at once within the bandwidth limit */
+	uint64_t seed; /* of the random decisions, the channel no. is added to it */
+} ImpairConfig;
+
+/* A packet held back until its delivery time */
+typedef struct delayed_packet {
+	uint64_t release_usec; /* monotonic time of delivery */
+	Packet pkt; /* its payload follows the structure */
+	struct delayed_packet* next;
+} DelayedPacket;
+
+/*
+ * Simulated link in front of the receiving end of a channel connection.
+ * Received packets are lost, duplicated, delayed, reordered or shaped to a
+ * bandwidth as configured, and handed to the caller once they are due.
+ * Latency and jitter keep the packets in order, only reordering lets a packet
+ * overtake others. A timer of the caller's timer wheel fires when the next
+ * held packet becomes due, so nothing blocks and the event loop keeps running
+ * meanwhile.
+ */
+typedef struct impairer {
+	const ImpairConfig* cfg;
+	int channel_no;
+	int is_active; /* 0 if the configuration impairs nothing, packets then pass straight through */
+	uint64_t rng; /* state of the random decisions */
+	int is_bad; /* state of the burst loss model */
+	double tat_usec; /* theoretical arrival time of the bandwidth limit */
+	uint64_t last_release_usec; /* latest delivery time, which delivery keeps to unless a packet is reordered */
+	int conn_status; /* -1 or -2 once the connection has failed or been closed, 0 otherwise */
+
+	DelayedPacket* held; /* packets not due yet, by delivery time */
+	DelayedPacket* held_tail;
+	DelayedPacket* delivered; /* the packet handed to the caller last, freed by the next call */
+	TimerWheel* timers;
+	Timer timer; /* fires when the first held packet is due */
+	TraceRing* trace; /* records the losses if set, along with the session ID */
+	uint64_t session_id;
+
+	/* statistics */
+	unsigned long dropped;
+	unsigned long duplicated;
+	unsigned long reordered;
+	unsigned long corrupted;
+} Impairer;
+
+void impair_config_init(ImpairConfig* cfg);
+int impair_config_parse(ImpairConfig* configs, int num_configs, const char* spec);
+int impair_is_active(const ImpairConfig* cfg);
+void impair_init(Impairer* im, const ImpairConfig* cfg, int channel_no, TimerWheel* timers, timer_handler handler,
+	void* arg);
+int impair_recv_packet(Impairer* im, Connection* conn, Packet* pkt);
+void impair_destroy(Impairer* im);
+
+#endif
@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "output.h"
+
+/**
+ * Checks that a path of the manifest stays below the root of the tree
+ * @param path	The path, relative to the root
+ *
+ * @return 1 if the path is safe, 0 otherwise
+ */
+static int is_safe_path(const char* path) {
+	if(path[0] == '/') {
+		return 0;
+	}
+	while(*path != '\0') {
+		size_t len = strcspn(path, "/");
+		if(len == 0 || (len == 1 && path[0] == '.') || (len == 2 && path[0] == '.' && path[1] == '.')) {
+			/* empty, current or parent directory */
+			return 0;
+		}
+		path += len;
+		if(*path == '/') {
+			path++;
+			if(*path == '\0') {
+				/* trailing separator */
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+/**
+ * Creates the directories leading to a file of the tree that do not exist yet
+ * @param path		The full path of the file
+ * @param root_len	The length of the root prefix of the path, which exists
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int make_parents(char* path, size_t root_len) {
+	for(char* sep = strchr(path + root_len + 1, '/'); sep != NULL; sep = strchr(sep + 1, '/')) {
+		*sep = '\0';
+		int status = mkdir(path, 0777);
+		*sep = '/';
+		if(status < 0 && errno != EEXIST) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Creates the file of the current entry of the tree and starts writing it
+ * @param o		The output
+ * @param skip	The no. of bytes of the file written before, which are kept
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int open_entry(Output* o, uint64_t skip) {
+	ManifestEntry* e = &o->entries[o->current];
+	char path[PATH_MAX];
+	if(snprintf(path, sizeof(path), "%s/%s", o->root, e->path) >= (int) sizeof(path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if(make_parents(path, strlen(o->root)) < 0 || writer_open(&o->writer, path, 0666, skip) < 0) {
+		return -1;
+	}
+	o->remaining = e->size - skip;
+	return 0;
+}
+
+/**
+ * Completes the file of the current entry of the tree and moves to the next one
+ * @param o	The output
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int close_entry(Output* o) {
+	ManifestEntry* e = &o->entries[o->current];
+	int status = 0;
+	if(fchmod(o->writer.fd, e->mode & 0777) < 0) {
+		status = -1;
+	}
+	if(writer_close(&o->writer) < 0) {
+		status = -1;
+	}
+	o->current++;
+	return status;
+}
+
+/**
+ * Opens the next file of the tree that has contents to be written, creating
+ * the empty files before it on the way
+ * @param o	The output
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int next_entry(Output* o) {
+	while(o->current < o->num_entries) {
+		if(open_entry(o, 0) < 0) {
+			return -1;
+		}
+		if(o->remaining > 0) {
+			return 0;
+		}
+		if(close_entry(o) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Decodes the complete manifest and checks it against the stream
+ * @param o		The output
+ * @param start	The offset in the stream writing starts at, at least the
+ * 				size of the manifest
+ *
+ * @return 0 on success, -1 on failure (EPROTO if the manifest is invalid)
+ */
+static int load_manifest(Output* o, uint64_t start) {
+	if(decode_manifest(o->manifest, o->manifest_size, &o->entries, &o->num_entries) < 0) {
+		o->entries = NULL;
+		errno = EPROTO;
+		return -1;
+	}
+
+	/* the files must account for the rest of the stream exactly */
+	uint64_t total = o->manifest_size;
+	for(int i = 0; i < o->num_entries; i++) {
+		if(!is_safe_path(o->entries[i].path) || o->entries[i].size > UINT64_MAX - total) {
+			errno = EPROTO;
+			return -1;
+		}
+		total += o->entries[i].size;
+	}
+	if(total != o->stream_size) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	/* when resuming, the files before the start are complete and the one containing it is kept up to there */
+	uint64_t pos = o->manifest_size;
+	o->current = 0;
+	while(o->current < o->num_entries && pos + o->entries[o->current].size <= start &&
+		(pos < start || o->entries[o->current].size > 0)) {
+		pos += o->entries[o->current].size;
+		o->current++;
+	}
+	if(o->current < o->num_entries && pos < start) {
+		if(open_entry(o, start - pos) < 0) {
+			return -1;
+		}
+		return 0;
+	}
+	return next_entry(o);
+}
+
+/**
+ * Opens the destination of a transfer. A single file is created (or
+ * truncated) right away, the root directory of a tree is created if it does
+ * not exist. A resumed transfer keeps what was written before its start.
+ * @param o				The output
+ * @param root			The path of the file or of the root directory
+ * @param stream_size	The no. of bytes of the stream
+ * @param manifest_size	The no. of bytes of the manifest at the start of the
+ * 						stream, 0 for a single file
+ * @param start			The offset in the stream writing starts at
+ * @param manifest		The manifest of a tree resumed past its start, NULL
+ * 						otherwise
+ * @param use_uring		1 to write through io_uring if the kernel allows it
+ *
+ * @return 0 on success, -1 on failure
+ */
+int output_open(Output* o, const char* root, uint64_t stream_size, uint64_t manifest_size, uint64_t start,
+	const unsigned char* manifest, int use_uring) {
+	memset(o, 0, sizeof(Output));
+	snprintf(o->root, sizeof(o->root), "%s", root);
+	o->stream_size = stream_size;
+	o->manifest_size = manifest_size;
+	o->is_tree = (manifest_size > 0);
+	if(writer_init(&o->writer, use_uring) < 0) {
+		return -1;
+	}
+	if(!o->is_tree) {
+		if(writer_open(&o->writer, root, 0666, start) < 0) {
+			writer_destroy(&o->writer);
+			return -1;
+		}
+		return 0;
+	}
+
+	o->manifest = malloc(manifest_size);
+	if(o->manifest == NULL || (mkdir(root, 0777) < 0 && errno != EEXIST)) {
+		if(o->manifest == NULL) {
+			errno = ENOMEM;
+		}
+		output_close(o);
+		return -1;
+	}
+	if(start > 0) {
+		/* the part of the manifest received again is identical */
+		memcpy(o->manifest, manifest, manifest_size);
+		o->manifest_len = (start < manifest_size) ? start : manifest_size;
+		if(o->manifest_len == manifest_size && load_manifest(o, start) < 0) {
+			output_close(o);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Reserves the disk space of a single file, so that it can be written at any offset
+ * @param o	The output
+ *
+ * @return 0 on success, -1 on failure
+ */
+int output_preallocate(Output* o) {
+	return writer_preallocate(&o->writer, o->stream_size);
+}
+
+/**
+ * Appends the next part of the stream to the output
+ * @param o		The output
+ * @param data	The data
+ * @param len	The no. of bytes
+ *
+ * @return 0 on success, -1 on failure (errno is set)
+ */
+int output_append(Output* o, const char* data, size_t len) {
+	if(!o->is_tree) {
+		return writer_append(&o->writer, data, len);
+	}
+	while(len > 0) {
+		if(o->entries == NULL) {
+			/* still collecting the manifest */
+			size_t n = o->manifest_size - o->manifest_len;
+			if(n > len) {
+				n = len;
+			}
+			memcpy(o->manifest + o->manifest_len, data, n);
+			o->manifest_len += n;
+			data += n;
+			len -= n;
+			if(o->manifest_len == o->manifest_size && load_manifest(o, o->manifest_size) < 0) {
+				return -1;
+			}
+			continue;
+		}
+		if(o->current == o->num_entries) {
+			/* more contents than the manifest lists */
+			errno = EPROTO;
+			return -1;
+		}
+
+		size_t n = len;
+		if(n > o->remaining) {
+			n = o->remaining;
+		}
+		if(writer_append(&o->writer, data, n) < 0) {
+			return -1;
+		}
+		o->remaining -= n;
+		data += n;
+		len -= n;
+		if(o->remaining == 0 && (close_entry(o) < 0 || next_entry(o) < 0)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Writes a part of a single file right away at its offset
+ * @param o			The output
+ * @param data		The data
+ * @param len		The no. of bytes
+ * @param offset	The offset of the data in the stream
+ *
+ * @return 0 on success, -1 on failure (errno is set)
+ */
+int output_write_at(Output* o, const char* data, size_t len, uint64_t offset) {
+	return writer_write_at(&o->writer, data, len, offset);
+}
+
+/**
+ * Hands everything appended so far to the kernel, so that it survives the
+ * end of the session
+ * @param o	The output
+ *
+ * @return 0 on success, -1 on failure (errno is set)
+ */
+int output_sync(Output* o) {
+	if(o->writer.fd < 0) {
+		return 0;
+	}
+	return writer_flush(&o->writer);
+}
+
+/**
+ * Writes everything appended so far. Every file of a tree has been completed
+ * by then.
+ * @param o	The output
+ *
+ * @return 0 on success, -1 on failure (EPROTO if files of the tree are missing)
+ */
+int output_flush(Output* o) {
+	if(!o->is_tree) {
+		return writer_flush(&o->writer);
+	}
+	if(o->entries == NULL || o->current < o->num_entries) {
+		errno = EPROTO;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Closes the file being written, if any, and releases the output
+ * @param o	The output
+ */
+void output_close(Output* o) {
+	writer_destroy(&o->writer);
+	free(o->manifest);
+	o->manifest = NULL;
+	if(o->entries != NULL) {
+		free_manifest(o->entries, o->num_entries);
+		o->entries = NULL;
+	}
+}
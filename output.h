@@ -0,0 +1,41 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+
+#include "protocol.h"
+#include "writer.h"
+
+/*
+ * Destination of the stream of a transfer. A single file is written as the
+ * stream arrives. A tree stream starts with a manifest, which is collected
+ * first. The contents that follow are then split into the files it lists, and
+ * those files are created below the root directory one after the other.
+ */
+typedef struct output {
+	Writer writer; /* of the file being written, reused for every file of a tree */
+	char root[PATH_MAX]; /* the file, or the directory of a tree */
+	int is_tree;
+	uint64_t stream_size; /* bytes of the whole stream, manifest included */
+
+	unsigned char* manifest; /* raw manifest, kept for the checkpoints */
+	uint64_t manifest_size;
+	uint64_t manifest_len; /* bytes of the manifest received so far */
+	ManifestEntry* entries; /* files of the tree, NULL until the manifest is complete */
+	int num_entries;
+	int current; /* entry being written, num_entries once all are complete */
+	uint64_t remaining; /* bytes of the current entry still to be written */
+} Output;
+
+int output_open(Output* o, const char* root, uint64_t stream_size, uint64_t manifest_size, uint64_t start,
+	const unsigned char* manifest, int use_uring);
+int output_preallocate(Output* o);
+int output_append(Output* o, const char* data, size_t len);
+int output_write_at(Output* o, const char* data, size_t len, uint64_t offset);
+int output_sync(Output* o);
+int output_flush(Output* o);
+void output_close(Output* o);
+
+#endif
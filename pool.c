@@ -0,0 +1,92 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+/**
+ * Allocates the buffers of a pool, all free. The memory of a buffer is only
+ * faulted in once it is first used.
+ * @param pool			The pool
+ * @param capacity		The no. of buffers
+ * @param buffer_size	The size of a buffer
+ *
+ * @return 0 on success, -1 on failure
+ */
+int pool_init(BufferPool* pool, int capacity, size_t buffer_size) {
+	memset(pool, 0, sizeof(BufferPool));
+	pool->stride = (buffer_size + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
+	pool->capacity = capacity;
+	pool->block = aligned_alloc(POOL_ALIGN, (capacity > 0 ? capacity : 1) * pool->stride);
+	pool->refs = calloc(capacity > 0 ? capacity : 1, sizeof(uint32_t));
+	pool->free_list = malloc((capacity > 0 ? capacity : 1) * sizeof(int));
+	if(pool->block == NULL || pool->refs == NULL || pool->free_list == NULL) {
+		pool_destroy(pool);
+		return -1;
+	}
+
+	/* the lowest buffers are handed out first */
+	for(int i = 0; i < capacity; i++) {
+		pool->free_list[i] = capacity - 1 - i;
+	}
+	pool->num_free = capacity;
+	return 0;
+}
+
+/**
+ * Takes a free buffer, with a single reference
+ * @param pool	The pool
+ *
+ * @return The handle of the buffer, POOL_NONE if all are in use
+ */
+int pool_acquire(BufferPool* pool) {
+	if(pool->num_free == 0) {
+		return POOL_NONE;
+	}
+	int buf = pool->free_list[--pool->num_free];
+	pool->refs[buf] = 1;
+	return buf;
+}
+
+/**
+ * Adds a reference to a buffer in use, for another holder
+ * @param pool	The pool
+ * @param buf	The handle of the buffer, or POOL_NONE
+ */
+void pool_ref(BufferPool* pool, int buf) {
+	if(buf != POOL_NONE) {
+		pool->refs[buf]++;
+	}
+}
+
+/**
+ * Releases a reference to a buffer, which returns to the pool with the last
+ * @param pool	The pool
+ * @param buf	The handle of the buffer, or POOL_NONE
+ */
+void pool_release(BufferPool* pool, int buf) {
+	if(buf != POOL_NONE && --pool->refs[buf] == 0) {
+		pool->free_list[pool->num_free++] = buf;
+	}
+}
+
+/**
+ * Gets the memory of a buffer
+ * @param pool	The pool
+ * @param buf	The handle of the buffer
+ *
+ * @return The buffer, aligned to POOL_ALIGN
+ */
+char* pool_data(BufferPool* pool, int buf) {
+	return pool->block + (size_t) buf * pool->stride;
+}
+
+/**
+ * Releases the memory of a pool, whatever buffers are still in use
+ * @param pool	The pool
+ */
+void pool_destroy(BufferPool* pool) {
+	free(pool->block);
+	free(pool->refs);
+	free(pool->free_list);
+	memset(pool, 0, sizeof(BufferPool));
+}
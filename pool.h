@@ -0,0 +1,32 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define POOL_ALIGN 64 /* every buffer starts on a cache line */
+#define POOL_NONE -1 /* handle of no buffer */
+
+/*
+ * Fixed set of equal buffers carved from one block allocated up front, so
+ * that taking and returning a buffer never allocates. Buffers are handed out
+ * as handles. Every holder of a buffer holds a reference, and it returns to
+ * the pool once the last one is released. Only meant for a single thread.
+ */
+typedef struct buffer_pool {
+	char* block; /* the buffers, stride bytes apart */
+	size_t stride; /* size of a buffer rounded up to POOL_ALIGN */
+	uint32_t* refs; /* references to every buffer, 0 if free */
+	int* free_list; /* handles of the free buffers, used as a stack */
+	int num_free;
+	int capacity;
+} BufferPool;
+
+int pool_init(BufferPool* pool, int capacity, size_t buffer_size);
+int pool_acquire(BufferPool* pool);
+void pool_ref(BufferPool* pool, int buf);
+void pool_release(BufferPool* pool, int buf);
+char* pool_data(BufferPool* pool, int buf);
+void pool_destroy(BufferPool* pool);
+
+#endif
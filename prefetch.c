@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "prefetch.h"
+#include "timer.h"
+
+/**
+ * Body of the reader thread, reads the stream ahead of the sender until the
+ * end or until the prefetcher is stopped
+ * @param arg	The prefetcher
+ */
+static void* read_ahead(void* arg) {
+	Prefetcher* p = arg;
+	struct timespec pause = { 0, PREFETCH_PAUSE_USEC * 1000L };
+	uint64_t pos = p->start;
+	int cursor = 0;
+	while(atomic_load_explicit(&p->is_running, memory_order_relaxed)) {
+		/* never read what the sender has already read itself */
+		uint64_t consumed = atomic_load_explicit(&p->consumed, memory_order_relaxed);
+		if(pos < consumed) {
+			pos = consumed;
+		}
+		if(pos >= p->src->size) {
+			break;
+		}
+		uint64_t head = atomic_load_explicit(&p->head, memory_order_relaxed);
+		if(head - atomic_load_explicit(&p->tail, memory_order_acquire) >= p->capacity) {
+			nanosleep(&pause, NULL);
+			continue;
+		}
+
+		uint64_t start = monotonic_usec();
+		Prefetched* e = &p->entries[head & (p->capacity - 1)];
+		e->seq_no = pos;
+		e->size = (p->src->size - pos < p->packet_size) ? p->src->size - pos : p->packet_size;
+		e->checksum = source_checksum(p->src, pos, e->size, &cursor);
+		atomic_store_explicit(&p->head, head + 1, memory_order_release);
+		p->read_usec += monotonic_usec() - start;
+		pos += e->size;
+	}
+	return NULL;
+}
+
+/**
+ * Starts reading the stream ahead of the sender. Nothing is started for an
+ * empty stream.
+ * @param p				The prefetcher
+ * @param src			The stream, opened
+ * @param start			The offset the sender starts at, a multiple of the
+ * 						packet size
+ * @param packet_size	The payload bytes of a packet
+ *
+ * @return 0 on success, -1 on failure
+ */
+int prefetcher_start(Prefetcher* p, Source* src, uint64_t start, uint32_t packet_size) {
+	memset(p, 0, sizeof(Prefetcher));
+	atomic_init(&p->head, 0);
+	atomic_init(&p->tail, 0);
+	atomic_init(&p->consumed, start);
+	atomic_init(&p->is_running, 1);
+	p->src = src;
+	p->start = start;
+	p->packet_size = packet_size;
+	if(start >= src->size) {
+		return 0;
+	}
+
+	p->capacity = 2;
+	while(p->capacity < READ_AHEAD_BYTES / packet_size) {
+		p->capacity *= 2;
+	}
+	p->entries = malloc(p->capacity * sizeof(Prefetched));
+	if(p->entries == NULL) {
+		return -1;
+	}
+	int status = pthread_create(&p->thread, NULL, read_ahead, p);
+	if(status != 0) {
+		free(p->entries);
+		p->entries = NULL;
+		errno = status;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Takes the next packet read ahead, if the reader has got to it. Packets must
+ * be taken in the order of the stream.
+ * @param p			The prefetcher
+ * @param seq_no	The sequence no. of the packet
+ * @param checksum	Set to the CRC32C of the payload
+ *
+ * @return 1 if the packet was read ahead, 0 if the sender has to read it
+ */
+int prefetcher_take(Prefetcher* p, uint64_t seq_no, uint32_t* checksum) {
+	if(p->entries == NULL) {
+		return 0;
+	}
+	int found = 0;
+	uint64_t tail = atomic_load_explicit(&p->tail, memory_order_relaxed);
+	uint64_t head = atomic_load_explicit(&p->head, memory_order_acquire);
+
+	/* drop the packets the reader queued after the sender had read them */
+	while(tail < head && p->entries[tail & (p->capacity - 1)].seq_no < seq_no) {
+		tail++;
+	}
+	if(tail < head && p->entries[tail & (p->capacity - 1)].seq_no == seq_no) {
+		*checksum = p->entries[tail & (p->capacity - 1)].checksum;
+		tail++;
+		found = 1;
+	}
+	atomic_store_explicit(&p->tail, tail, memory_order_release);
+	atomic_store_explicit(&p->consumed, seq_no + p->packet_size, memory_order_relaxed);
+	if(found) {
+		p->hits++;
+	} else {
+		p->misses++;
+	}
+	return found;
+}
+
+/**
+ * Stops the reader thread and releases the queue
+ * @param p	The prefetcher
+ */
+void prefetcher_stop(Prefetcher* p) {
+	if(p->entries == NULL) {
+		return;
+	}
+	atomic_store(&p->is_running, 0);
+	pthread_join(p->thread, NULL);
+	free(p->entries);
+	p->entries = NULL;
+}
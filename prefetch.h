@@ -0,0 +1,51 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "source.h"
+
+#define READ_AHEAD_BYTES (16 * 1024 * 1024) /* most bytes of the stream read ahead of the sender */
+#define PREFETCH_PAUSE_USEC 200 /* pause of the reader thread while its queue is full */
+
+/* A packet of the stream read ahead of the sender */
+typedef struct prefetched {
+	uint64_t seq_no;
+	uint32_t size;
+	uint32_t checksum; /* CRC32C of the payload */
+} Prefetched;
+
+/*
+ * Reads the stream ahead of the sender from its own thread, so that the
+ * sender neither waits for the disk nor spends its time on checksums. The
+ * reader cuts the stream into packets as the sender does and checksums them,
+ * which faults the pages of mapped files in, and queues them in a
+ * single-producer single-consumer ring. The sender takes them in order. If it
+ * catches up with the reader, it reads the packet itself and the reader skips
+ * ahead of it.
+ */
+typedef struct prefetcher {
+	_Alignas(64) atomic_uint_fast64_t head; /* next entry to be queued, written by the reader */
+	_Alignas(64) atomic_uint_fast64_t tail; /* next entry to be taken, written by the sender */
+	_Alignas(64) atomic_uint_fast64_t consumed; /* offset of the stream the sender has reached */
+	atomic_int is_running;
+	Prefetched* entries; /* NULL unless the reader thread was started */
+	uint32_t capacity; /* entries of the ring, a power of two */
+	Source* src;
+	uint64_t start; /* offset the reader starts at */
+	uint32_t packet_size;
+	pthread_t thread;
+
+	/* statistics */
+	uint64_t read_usec; /* time the reader spent reading, valid once stopped */
+	unsigned long hits; /* packets the sender found queued */
+	unsigned long misses; /* packets the sender read itself */
+} Prefetcher;
+
+int prefetcher_start(Prefetcher* p, Source* src, uint64_t start, uint32_t packet_size);
+int prefetcher_take(Prefetcher* p, uint64_t seq_no, uint32_t* checksum);
+void prefetcher_stop(Prefetcher* p);
+
+#endif
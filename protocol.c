@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "protocol.h"
+
+/**
+ * Stores an integer in network byte order
+ * @param buf	The destination
+ * @param val	The value
+ * @param len	The no. of bytes of the value
+ */
+static void put_uint(unsigned char* buf, uint64_t val, int len) {
+	for(int i = len - 1; i >= 0; i--) {
+		buf[i] = val & 0xff;
+		val >>= 8;
+	}
+}
+
+/**
+ * Loads an integer stored in network byte order
+ * @param buf	The source
+ * @param len	The no. of bytes of the value
+ * 
+ * @return The value
+ */
+static uint64_t get_uint(const unsigned char* buf, int len) {
+	uint64_t val = 0;
+	for(int i = 0; i < len; i++) {
+		val = (val << 8) | buf[i];
+	}
+	return val;
+}
+
+/**
+ * Serializes the header of a packet
+ * @param pkt	The packet
+ * @param buf	The destination, HEADER_SIZE bytes
+ */
+void encode_header(const Packet* pkt, unsigned char* buf) {
+	buf[0] = pkt->type;
+	buf[1] = (pkt->is_last ? FLAG_LAST : 0) | (pkt->is_compressed ? FLAG_COMPRESSED : 0);
+	put_uint(buf + 2, pkt->channel_no, 2);
+	put_uint(buf + 4, pkt->payload_size, 4);
+	put_uint(buf + 8, pkt->seq_no, 8);
+	put_uint(buf + 16, pkt->checksum, 4);
+}
+
+/**
+ * Deserializes the header of a packet, the payload is left untouched
+ * @param buf	The source, HEADER_SIZE bytes
+ * @param pkt	Output, the packet
+ * 
+ * @return 0 on success, -1 if the header is malformed
+ */
+int decode_header(const unsigned char* buf, Packet* pkt) {
+	pkt->type = buf[0];
+	pkt->is_last = (buf[1] & FLAG_LAST) ? 1 : 0;
+	pkt->is_compressed = (buf[1] & FLAG_COMPRESSED) ? 1 : 0;
+	pkt->channel_no = get_uint(buf + 2, 2);
+	pkt->payload_size = get_uint(buf + 4, 4);
+	pkt->seq_no = get_uint(buf + 8, 8);
+	pkt->checksum = get_uint(buf + 16, 4);
+	if(pkt->type > PKT_REFUSE || pkt->channel_no >= MAX_CHANNELS) {
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Serializes the payload of a HELLO packet
+ * @param hello	The negotiated parameters
+ * @param buf	The destination, MAX_HELLO_SIZE bytes
+ * 
+ * @return The size of the payload
+ */
+uint32_t encode_hello(const Hello* hello, unsigned char* buf) {
+	size_t name_len = strnlen(hello->name, MAX_NAME_LEN);
+	put_uint(buf, hello->packet_size, 4);
+	put_uint(buf + 4, hello->num_channels, 2);
+	put_uint(buf + 6, hello->window, 2);
+	put_uint(buf + 8, hello->session_id, 8);
+	put_uint(buf + 16, hello->file_size, 8);
+	put_uint(buf + 24, hello->manifest_size, 8);
+	put_uint(buf + 32, hello->file_id, 8);
+	put_uint(buf + 40, hello->start_seq, 8);
+	memcpy(buf + HELLO_FIXED_SIZE, hello->name, name_len);
+	return HELLO_FIXED_SIZE + name_len;
+}
+
+/**
+ * Deserializes the payload of a HELLO packet
+ * @param buf	The source
+ * @param len	The payload size of the HELLO
+ * @param hello	Output, the negotiated parameters
+ * 
+ * @return 0 on success, -1 if the payload is malformed
+ */
+int decode_hello(const unsigned char* buf, uint32_t len, Hello* hello) {
+	if(len < HELLO_FIXED_SIZE || len > MAX_HELLO_SIZE) {
+		return -1;
+	}
+	hello->packet_size = get_uint(buf, 4);
+	hello->num_channels = get_uint(buf + 4, 2);
+	hello->window = get_uint(buf + 6, 2);
+	hello->session_id = get_uint(buf + 8, 8);
+	hello->file_size = get_uint(buf + 16, 8);
+	hello->manifest_size = get_uint(buf + 24, 8);
+	hello->file_id = get_uint(buf + 32, 8);
+	hello->start_seq = get_uint(buf + 40, 8);
+	memcpy(hello->name, buf + HELLO_FIXED_SIZE, len - HELLO_FIXED_SIZE);
+	hello->name[len - HELLO_FIXED_SIZE] = '\0';
+	if(strlen(hello->name) != len - HELLO_FIXED_SIZE) {
+		/* embedded NUL */
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Serializes the SACK blocks forming the payload of an ACK
+ * @param blocks		The ranges received out of order
+ * @param num_blocks	The no. of ranges, at most MAX_SACK_BLOCKS
+ * @param buf			The destination, num_blocks * SACK_BLOCK_SIZE bytes
+ */
+void encode_sack(const SackBlock* blocks, int num_blocks, unsigned char* buf) {
+	for(int i = 0; i < num_blocks; i++) {
+		put_uint(buf + i * SACK_BLOCK_SIZE, blocks[i].start, 8);
+		put_uint(buf + i * SACK_BLOCK_SIZE + 8, blocks[i].end, 8);
+	}
+}
+
+/**
+ * Deserializes the SACK blocks forming the payload of an ACK
+ * @param buf		The source
+ * @param len		The payload size of the ACK
+ * @param blocks	Output, space for MAX_SACK_BLOCKS ranges
+ * 
+ * @return The no. of ranges, -1 if the payload is malformed
+ */
+int decode_sack(const unsigned char* buf, uint32_t len, SackBlock* blocks) {
+	if(len % SACK_BLOCK_SIZE != 0 || len / SACK_BLOCK_SIZE > MAX_SACK_BLOCKS) {
+		return -1;
+	}
+	int num_blocks = len / SACK_BLOCK_SIZE;
+	for(int i = 0; i < num_blocks; i++) {
+		blocks[i].start = get_uint(buf + i * SACK_BLOCK_SIZE, 8);
+		blocks[i].end = get_uint(buf + i * SACK_BLOCK_SIZE + 8, 8);
+	}
+	return num_blocks;
+}
+
+/**
+ * Computes the size of the manifest of a tree transfer
+ * @param entries		The files of the tree
+ * @param num_entries	The no. of files
+ * 
+ * @return The size of the manifest in bytes
+ */
+size_t manifest_size(const ManifestEntry* entries, int num_entries) {
+	size_t size = MANIFEST_HEADER_SIZE;
+	for(int i = 0; i < num_entries; i++) {
+		size += MANIFEST_ENTRY_SIZE + strlen(entries[i].path);
+	}
+	return size;
+}
+
+/**
+ * Serializes the manifest of a tree transfer
+ * @param entries		The files of the tree
+ * @param num_entries	The no. of files
+ * @param buf			The destination, manifest_size() bytes
+ */
+void encode_manifest(const ManifestEntry* entries, int num_entries, unsigned char* buf) {
+	put_uint(buf, num_entries, 4);
+	buf += MANIFEST_HEADER_SIZE;
+	for(int i = 0; i < num_entries; i++) {
+		size_t path_len = strlen(entries[i].path);
+		put_uint(buf, entries[i].size, 8);
+		put_uint(buf + 8, entries[i].mode, 4);
+		put_uint(buf + 12, path_len, 2);
+		memcpy(buf + MANIFEST_ENTRY_SIZE, entries[i].path, path_len);
+		buf += MANIFEST_ENTRY_SIZE + path_len;
+	}
+}
+
+/**
+ * Deserializes the manifest of a tree transfer. The paths are not checked.
+ * @param buf			The source
+ * @param len			The size of the manifest
+ * @param entries		Output, the files of the tree, to be released with
+ * 						free_manifest()
+ * @param num_entries	Output, the no. of files
+ * 
+ * @return 0 on success, -1 if the manifest is malformed or memory ran out
+ */
+int decode_manifest(const unsigned char* buf, size_t len, ManifestEntry** entries, int* num_entries) {
+	if(len < MANIFEST_HEADER_SIZE) {
+		return -1;
+	}
+	uint64_t count = get_uint(buf, 4);
+	if(count > (len - MANIFEST_HEADER_SIZE) / MANIFEST_ENTRY_SIZE) {
+		return -1;
+	}
+	*entries = calloc(count > 0 ? count : 1, sizeof(ManifestEntry));
+	if(*entries == NULL) {
+		return -1;
+	}
+	*num_entries = 0;
+
+	size_t pos = MANIFEST_HEADER_SIZE;
+	for(uint64_t i = 0; i < count; i++) {
+		if(len - pos < MANIFEST_ENTRY_SIZE) {
+			break;
+		}
+		ManifestEntry* entry = &(*entries)[i];
+		entry->size = get_uint(buf + pos, 8);
+		entry->mode = get_uint(buf + pos + 8, 4);
+		size_t path_len = get_uint(buf + pos + 12, 2);
+		pos += MANIFEST_ENTRY_SIZE;
+		if(path_len == 0 || path_len > MAX_PATH_LEN || len - pos < path_len ||
+			memchr(buf + pos, '\0', path_len) != NULL) {
+			break;
+		}
+		entry->path = malloc(path_len + 1);
+		if(entry->path == NULL) {
+			break;
+		}
+		memcpy(entry->path, buf + pos, path_len);
+		entry->path[path_len] = '\0';
+		pos += path_len;
+		(*num_entries)++;
+	}
+	if(*num_entries != (int) count || pos != len) {
+		free_manifest(*entries, *num_entries);
+		*entries = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Releases a manifest returned by decode_manifest()
+ * @param entries		The files of the tree
+ * @param num_entries	The no. of files
+ */
+void free_manifest(ManifestEntry* entries, int num_entries) {
+	for(int i = 0; i < num_entries; i++) {
+		free(entries[i].path);
+	}
+	free(entries);
+}
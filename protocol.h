@@ -0,0 +1,119 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include "commons.h"
+
+/*
+ * Every packet is sent as a fixed-size header followed by payload_size bytes
+ * of payload. All fields are in network byte order:
+ *
+ *   0      1      2             4                   8                  16         20
+ *   +------+------+-------------+-------------------+------------------+----------+
+ *   | type | flags| channel_no  |   payload_size    |      seq_no      | checksum |
+ *   +------+------+-------------+-------------------+------------------+----------+
+ *
+ * The payload of a data packet flagged as compressed is an LZ4 block of its
+ * part of the stream, see compress.h. The sender compresses the packets that
+ * shrink enough, the others are sent as they are.
+ *
+ * The checksum of a data packet is the CRC32C of its part of the stream,
+ * before any compression, the receiver drops a packet that does not match.
+ * The final ACK carries the CRC32C of the whole stream as received, for the
+ * sender to compare with its own. It is 0 in any other packet.
+ */
+#define HEADER_SIZE 20
+
+/* packet types */
+#define PKT_DATA 0
+#define PKT_ACK 1
+#define PKT_HELLO 2 /* negotiates the parameters of a transfer on every channel */
+#define PKT_REJOIN 3 /* HELLO of a channel replacing a broken one of a running transfer */
+#define PKT_REFUSE 4 /* answer to a HELLO the server does not accept, the payload is the reason as text */
+
+/* header flags */
+#define FLAG_LAST 0x01
+#define FLAG_COMPRESSED 0x02
+
+/*
+ * Payload of a HELLO packet. The client proposes the parameters, the server
+ * answers with the ones it accepted. Every channel of a transfer carries the
+ * same session ID, which lets the server group the channels of concurrent
+ * transfers. The fixed fields are followed by the name of the destination
+ * file (or directory), without a terminating NUL:
+ *
+ *   0             4            6            8            16           24              32
+ *   +-------------+------------+------------+------------+------------+---------------+
+ *   | packet_size |num_channels|   window   | session_id | file_size  | manifest_size |
+ *   +-------------+------------+------------+------------+------------+---------------+
+ *   32            40           48
+ *   +-------------+------------+------
+ *   |   file_id   | start_seq  | name
+ *   +-------------+------------+------
+ *
+ * A client resuming an interrupted transfer proposes a non-zero start_seq,
+ * the furthest offset it is willing to start from. The server answers with
+ * the offset it has checkpointed for the same file_id, 0 if it has none.
+ */
+#define HELLO_FIXED_SIZE 48
+#define MAX_NAME_LEN 255
+#define MAX_HELLO_SIZE (HELLO_FIXED_SIZE + MAX_NAME_LEN)
+typedef struct hello {
+	uint32_t packet_size; /* payload bytes per data packet */
+	uint16_t num_channels;
+	uint16_t window;
+	uint64_t session_id;
+	uint64_t file_size; /* bytes to be transferred */
+	uint64_t manifest_size; /* bytes of manifest at the start of a tree transfer, 0 for a single file */
+	uint64_t file_id; /* identifies the version of the input, a checkpoint only resumes the same one */
+	uint64_t start_seq; /* offset the stream is sent from */
+	char name[MAX_NAME_LEN + 1]; /* NUL-terminated */
+} Hello;
+
+/*
+ * Payload of an ACK. The seq_no of an ACK is cumulative: every byte before it
+ * has been received. The payload lists up to MAX_SACK_BLOCKS further ranges
+ * [start, end) received out of order, each as two 64-bit offsets. The range
+ * holding the packet received last comes first, the others are in no
+ * particular order.
+ */
+#define MAX_SACK_BLOCKS 4
+#define SACK_BLOCK_SIZE 16
+typedef struct sack_block {
+	uint64_t start;
+	uint64_t end;
+} SackBlock;
+
+/*
+ * A transfer of several files (a tree) sends one stream: a manifest listing
+ * the files, followed by the contents of the files in the order of the
+ * manifest. The manifest is a 32-bit count of entries, each entry being
+ *
+ *   0                 8          12        14
+ *   +-----------------+----------+---------+------
+ *   |      size       |   mode   |path_len | path
+ *   +-----------------+----------+---------+------
+ *
+ * where path is relative to the destination directory, with '/' separators.
+ */
+#define MANIFEST_HEADER_SIZE 4
+#define MANIFEST_ENTRY_SIZE 14 /* without the path */
+#define MAX_MANIFEST_SIZE (64 * 1024 * 1024)
+#define MAX_PATH_LEN 4095
+typedef struct manifest_entry {
+	char* path; /* NUL-terminated */
+	uint64_t size;
+	uint32_t mode; /* permission bits */
+} ManifestEntry;
+
+void encode_header(const Packet* pkt, unsigned char* buf);
+int decode_header(const unsigned char* buf, Packet* pkt);
+uint32_t encode_hello(const Hello* hello, unsigned char* buf);
+int decode_hello(const unsigned char* buf, uint32_t len, Hello* hello);
+void encode_sack(const SackBlock* blocks, int num_blocks, unsigned char* buf);
+int decode_sack(const unsigned char* buf, uint32_t len, SackBlock* blocks);
+size_t manifest_size(const ManifestEntry* entries, int num_entries);
+void encode_manifest(const ManifestEntry* entries, int num_entries, unsigned char* buf);
+int decode_manifest(const unsigned char* buf, size_t len, ManifestEntry** entries, int* num_entries);
+void free_manifest(ManifestEntry* entries, int num_entries);
+
+#endif
@@ -0,0 +1,267 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "reorder.h"
+#include "crc32c.h"
+
+/**
+ * Finds the slot owned by a sequence no.
+ * @param rb		The reorder buffer
+ * @param seq_no	The sequence no., a multiple of the packet size
+ *
+ * @return The index of the slot
+ */
+static uint32_t slot_of(ReorderBuffer* rb, uint64_t seq_no) {
+	return (uint32_t) (seq_no / rb->packet_size) & (rb->capacity - 1);
+}
+
+/**
+ * Checks whether a slot holds a packet
+ * @param rb	The reorder buffer
+ * @param slot	The index of the slot
+ *
+ * @return 1 if the slot is held, 0 otherwise
+ */
+static int is_held(ReorderBuffer* rb, uint32_t slot) {
+	return (rb->bitmap[slot / 64] >> (slot % 64)) & 1;
+}
+
+/**
+ * Moves the expected sequence no. past a packet, adding it to the digest
+ * @param rb			The reorder buffer
+ * @param payload_size	The size of the payload of the packet
+ * @param checksum		The CRC32C of the payload
+ */
+static void advance(ReorderBuffer* rb, uint32_t payload_size, uint32_t checksum) {
+	uint32_t shift = (payload_size == rb->packet_size) ? rb->shift : crc32c_shift(payload_size);
+	rb->digest = crc32c_combine(rb->digest, checksum, shift);
+	rb->next_seq += payload_size;
+}
+
+/**
+ * Initializes an empty reorder buffer
+ * @param rb			The reorder buffer
+ * @param next_seq		The sequence no. expected first, a multiple of the
+ * 						packet size
+ * @param digest		The CRC32C of the stream before next_seq
+ * @param capacity		The no. of packets it can hold, rounded up to a
+ * 						power of two
+ * @param packet_size	The size of every packet but the last
+ * @param hold_payloads	1 to keep copies of the payloads, 0 to only track
+ * 						which packets have been received
+ *
+ * @return 0 on success, -1 if the buffer could not be allocated
+ */
+int reorder_init(ReorderBuffer* rb, uint64_t next_seq, uint32_t digest, uint32_t capacity, uint32_t packet_size,
+	int hold_payloads) {
+	rb->capacity = 1;
+	while(rb->capacity < capacity) {
+		rb->capacity <<= 1;
+	}
+	rb->packet_size = packet_size;
+	rb->next_seq = next_seq;
+	rb->num_held = 0;
+	rb->num_recent = 0;
+	rb->digest = digest;
+	rb->shift = crc32c_shift(packet_size);
+
+	/* untouched parts of the slab are never faulted in by the OS */
+	rb->slab = NULL;
+	if(hold_payloads) {
+		rb->slab = malloc((size_t) rb->capacity * packet_size);
+	}
+	rb->sizes = malloc(rb->capacity * sizeof(uint32_t));
+	rb->checksums = malloc(rb->capacity * sizeof(uint32_t));
+	rb->bitmap = calloc((rb->capacity + 63) / 64, sizeof(uint64_t));
+	if((hold_payloads && rb->slab == NULL) || rb->sizes == NULL || rb->checksums == NULL || rb->bitmap == NULL) {
+		reorder_destroy(rb);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Releases the memory of a reorder buffer
+ * @param rb	The reorder buffer
+ */
+void reorder_destroy(ReorderBuffer* rb) {
+	free(rb->slab);
+	free(rb->sizes);
+	free(rb->checksums);
+	free(rb->bitmap);
+	rb->slab = NULL;
+	rb->sizes = NULL;
+	rb->checksums = NULL;
+	rb->bitmap = NULL;
+}
+
+/**
+ * Holds a copy of a packet received ahead of the next expected one, or only
+ * marks it as received if the buffer does not hold payloads
+ * @param rb			The reorder buffer
+ * @param seq_no		The sequence no. of the packet, greater than next_seq
+ * @param payload		The payload of the packet
+ * @param payload_size	The size of the payload
+ * @param checksum		The CRC32C of the payload
+ *
+ * @return 1 if the packet is now held, 0 if it already was, -1 if it lies
+ * 		   beyond the capacity of the buffer or is not aligned to a slot
+ */
+int reorder_insert(ReorderBuffer* rb, uint64_t seq_no, const char* payload, uint32_t payload_size, uint32_t checksum) {
+	if(seq_no % rb->packet_size != 0 || payload_size > rb->packet_size ||
+		(seq_no - rb->next_seq) / rb->packet_size >= rb->capacity) {
+		return -1;
+	}
+	uint32_t slot = slot_of(rb, seq_no);
+	if(is_held(rb, slot)) {
+		/* duplicate of a held packet */
+		return 0;
+	}
+	if(rb->slab != NULL) {
+		memcpy(rb->slab + (size_t) slot * rb->packet_size, payload, payload_size);
+	}
+	rb->sizes[slot] = payload_size;
+	rb->checksums[slot] = checksum;
+	rb->bitmap[slot / 64] |= (uint64_t) 1 << (slot % 64);
+	rb->num_held++;
+
+	/* the range of the packet is reported first from now on */
+	int n = (rb->num_recent < SACK_HISTORY) ? rb->num_recent++ : SACK_HISTORY - 1;
+	memmove(rb->recent + 1, rb->recent, n * sizeof(uint64_t));
+	rb->recent[0] = seq_no;
+	return 1;
+}
+
+/**
+ * Moves past the next expected packet, which the caller has written itself
+ * @param rb			The reorder buffer
+ * @param payload_size	The size of the payload of the packet
+ * @param checksum		The CRC32C of the payload
+ */
+void reorder_skip(ReorderBuffer* rb, uint32_t payload_size, uint32_t checksum) {
+	advance(rb, payload_size, checksum);
+}
+
+/**
+ * Writes all the held packets that continue the stream to the output and
+ * releases their slots. Packets adjacent in the slab are written together.
+ * Without a slab the packets have been written already and their slots are
+ * only released.
+ * @param rb	The reorder buffer
+ * @param out	The output, unused without a slab
+ *
+ * @return 0 on success, -1 if writing failed
+ */
+int reorder_flush(ReorderBuffer* rb, Output* out) {
+	char* run = NULL;
+	size_t run_len = 0;
+	while(rb->num_held > 0) {
+		uint32_t slot = slot_of(rb, rb->next_seq);
+		if(!is_held(rb, slot)) {
+			/* stop at the first gap */
+			break;
+		}
+		advance(rb, rb->sizes[slot], rb->checksums[slot]);
+		rb->bitmap[slot / 64] &= ~((uint64_t) 1 << (slot % 64));
+		rb->num_held--;
+		if(rb->slab == NULL) {
+			continue;
+		}
+
+		if(run == NULL) {
+			run = rb->slab + (size_t) slot * rb->packet_size;
+		}
+		run_len += rb->sizes[slot];
+		if(rb->sizes[slot] < rb->packet_size || slot == rb->capacity - 1) {
+			/* the next packet is not adjacent in the slab */
+			if(output_append(out, run, run_len) < 0) {
+				return -1;
+			}
+			run = NULL;
+			run_len = 0;
+		}
+	}
+	if(run_len > 0) {
+		return output_append(out, run, run_len);
+	}
+	return 0;
+}
+
+/**
+ * Finds the range of consecutive packets held around a held packet
+ * @param rb		The reorder buffer
+ * @param seq_no	The sequence no. of the held packet
+ * @param block		Output, the range
+ */
+static void range_of(ReorderBuffer* rb, uint64_t seq_no, SackBlock* block) {
+	/* the slot of next_seq is never held, which bounds the range below */
+	uint64_t start = seq_no;
+	while(is_held(rb, slot_of(rb, start - rb->packet_size))) {
+		start -= rb->packet_size;
+	}
+	uint64_t last = seq_no;
+	while((last + rb->packet_size - rb->next_seq) / rb->packet_size < rb->capacity &&
+		is_held(rb, slot_of(rb, last + rb->packet_size))) {
+		last += rb->packet_size;
+	}
+	block->start = start;
+	block->end = last + rb->sizes[slot_of(rb, last)];
+}
+
+/**
+ * Collects the ranges of consecutive packets held by the buffer, as RFC 2018
+ * has it: the range of the packet received last first, then the ranges of
+ * the packets received before it, most recent first. The remaining space is
+ * filled with the ranges closest to the expected sequence no.
+ * @param rb			The reorder buffer
+ * @param blocks		Output, space for max_blocks ranges
+ * @param max_blocks	The maximum no. of ranges to collect
+ *
+ * @return The no. of ranges
+ */
+int reorder_sack(ReorderBuffer* rb, SackBlock* blocks, int max_blocks) {
+	int num_blocks = 0;
+
+	/* forget the packets flushed since they arrived */
+	int num_recent = 0;
+	for(int i = 0; i < rb->num_recent; i++) {
+		if(rb->recent[i] > rb->next_seq) {
+			rb->recent[num_recent++] = rb->recent[i];
+		}
+	}
+	rb->num_recent = num_recent;
+	for(int i = 0; i < rb->num_recent && num_blocks < max_blocks; i++) {
+		int is_reported = 0;
+		for(int j = 0; j < num_blocks; j++) {
+			is_reported |= (rb->recent[i] >= blocks[j].start && rb->recent[i] < blocks[j].end);
+		}
+		if(!is_reported) {
+			range_of(rb, rb->recent[i], &blocks[num_blocks++]);
+		}
+	}
+	int num_recent_blocks = num_blocks;
+
+	/* the slot of next_seq itself is never held, stop once every held slot is seen */
+	uint32_t found = 0;
+	uint64_t seq_no = rb->next_seq + rb->packet_size;
+	while(num_blocks < max_blocks && found < rb->num_held && (seq_no - rb->next_seq) / rb->packet_size < rb->capacity) {
+		if(!is_held(rb, slot_of(rb, seq_no))) {
+			seq_no += rb->packet_size;
+			continue;
+		}
+		SackBlock block;
+		range_of(rb, seq_no, &block);
+		uint32_t num_packets = (block.end - block.start + rb->packet_size - 1) / rb->packet_size;
+		found += num_packets;
+		seq_no += (uint64_t) num_packets * rb->packet_size;
+
+		int is_reported = 0;
+		for(int j = 0; j < num_recent_blocks; j++) {
+			is_reported |= (blocks[j].start == block.start);
+		}
+		if(!is_reported) {
+			blocks[num_blocks++] = block;
+		}
+	}
+	return num_blocks;
+}
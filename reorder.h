@@ -0,0 +1,49 @@
+#ifndef REORDER_H
+#define REORDER_H
+
+#include <stdint.h>
+
+#include "protocol.h"
+#include "output.h"
+
+#define SACK_HISTORY 16 /* packets received last whose ranges are reported first */
+
+/*
+ * Buffer of the packets received ahead of the next expected one. Every packet
+ * but the last carries exactly packet_size bytes, so a packet owns the slot of
+ * its sequence no. in a ring of slots, its payload lives in the matching part
+ * of a single slab and a bitmap tells which slots are held. Without a slab the
+ * buffer only tracks which packets have been received, for a caller that has
+ * already written them to their place in the file. The CRC32C of the stream
+ * before the expected sequence no. is kept up to date from the checksums of
+ * the packets, whatever order they arrive in.
+ *
+ * The ranges held are reported as in RFC 2018: the range of the packet
+ * received last comes first, followed by the ranges of the packets received
+ * before it, so that every range is reported in a few ACKs in a row however
+ * many gaps there are.
+ */
+typedef struct reorder_buffer {
+	char* slab; /* payloads, packet_size bytes per slot, NULL if they are not held */
+	uint32_t* sizes; /* payload size held by each slot */
+	uint64_t* bitmap; /* slots holding a packet */
+	uint32_t capacity; /* no. of slots, a power of two */
+	uint32_t packet_size;
+	uint32_t* checksums; /* CRC32C of the payload held by each slot */
+	uint64_t next_seq; /* sequence no. expected next in the file */
+	uint32_t num_held;
+	uint32_t digest; /* CRC32C of the stream before next_seq */
+	uint32_t shift; /* crc32c_shift() of a full packet */
+	uint64_t recent[SACK_HISTORY]; /* sequence nos. of the packets held last, the latest first */
+	int num_recent;
+} ReorderBuffer;
+
+int reorder_init(ReorderBuffer* rb, uint64_t next_seq, uint32_t digest, uint32_t capacity, uint32_t packet_size,
+	int hold_payloads);
+void reorder_destroy(ReorderBuffer* rb);
+int reorder_insert(ReorderBuffer* rb, uint64_t seq_no, const char* payload, uint32_t payload_size, uint32_t checksum);
+void reorder_skip(ReorderBuffer* rb, uint32_t payload_size, uint32_t checksum);
+int reorder_flush(ReorderBuffer* rb, Output* out);
+int reorder_sack(ReorderBuffer* rb, SackBlock* blocks, int max_blocks);
+
+#endif
@@ -3,329 +3,1681 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
-#include <sys/select.h>
 #include <errno.h>
 #include <time.h>
 #include <string.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 
 #include "commons.h"
+#include "protocol.h"
+#include "eventloop.h"
+#include "conn.h"
+#include "timer.h"
+#include "reorder.h"
+#include "output.h"
+#include "checkpoint.h"
+#include "impair.h"
+#include "trace.h"
+#include "crc32c.h"
+#include "compress.h"
 
-#define TMP_BUFFER_SIZE 4 /* in terms of number of packets */
+#define MAX_WORKERS 256
+#define HELLO_TIMEOUT_MS 2000 /* max wait for the HELLO of a new channel */
+#define EXPIRY_INTERVAL_MS 500 /* period of the sweep for pending sessions not joined in time */
+#define JOIN_TIMEOUT_MS 10000 /* max wait for all the channels of a session to join */
+#define REJOIN_TIMEOUT_MS 10000 /* max wait for a channel to rejoin a session that has lost all of them */
 
 /**
- * Generates a new packet to be sent to the server
+ * Fills in a new packet to be sent to the client
+ * @param pkt			The packet, built in place
  * @param seq_no        THe sequence no. of the packet to be
  *                      acknowledged
  * @param channel_no	The channel through which the packet
  * 						will be sent
- * 
- * @return A new packet
  */
-Packet create_packet(unsigned int seq_no, int channel_no) {
-	Packet pkt;
-	pkt.seq_no = seq_no;
-	pkt.payload_size = 0;
-	pkt.channel_no = channel_no;
-	pkt.is_last = 0;
-	pkt.data_or_ack = 1; /* server always sends only ack pakcets */
-	return pkt;
+void create_packet(Packet* pkt, uint64_t seq_no, int channel_no) {
+	pkt->seq_no = seq_no;
+	pkt->payload_size = 0;
+	pkt->payload = NULL;
+	pkt->channel_no = channel_no;
+	pkt->is_last = 0;
+	pkt->checksum = 0;
+	pkt->is_compressed = 0;
+	pkt->type = PKT_ACK; /* server always sends only ack pakcets */
 }
 
 /**
- * Prints the trace of a packet ot the console
- * @param pkt	The packet whose trace is to be printed
+ * Function to report an error and terminate the program
+ * @param str	The error message
+ */
+void report_error(char* str) {
+	perror(str);
+	printf("Terminating program\n");
+	exit(0);
+}
+
+struct channel;
+struct session;
+struct worker;
+
+/* State of the stream being received */
+typedef struct receiver {
+	Output out; /* output file or tree */
+	int is_out_open;
+	int is_positional; /* packets are written at their offsets as they arrive, the reorder buffer only tracks them */
+
+	ReorderBuffer reorder; /* out-of-order packets and the sequence no. expected next */
+	Checkpoint checkpoint; /* progress saved for resuming the transfer */
+	Timer checkpoint_timer;
+	int is_last_rcvd;
+	uint64_t last_end; /* sequence no. following the last packet */
+	int is_last_ackd;
+
+	/* coalescing of acknowledgements */
+	int acks_pending; /* data packets received since the last ACK */
+	int ack_every; /* no. of data packets after which an ACK is sent right away */
+	struct channel* ack_channel; /* channel of the latest data packet */
+	Timer ack_timer; /* sends the pending ACK once ACK_DELAY_USEC have passed */
+	TimerWheel* timers;
+
+	/* statistics */
+	Timer stats_timer; /* prints the progress periodically */
+	uint32_t max_held; /* highest occupancy of the reorder buffer */
+	unsigned long duplicates; /* data packets received more than once */
+	unsigned long corrupted; /* data packets dropped for a checksum mismatch */
+	unsigned long decompressed; /* compressed data packets received */
+	uint64_t wire_bytes; /* compressed payload bytes of them */
+	uint64_t inflated_bytes; /* bytes of the stream in them */
+
+	char* inflated; /* the payload of the latest compressed packet, allocated on demand */
+} Receiver;
+
+/* State of a single channel of the transfer */
+typedef struct channel {
+	Connection conn;
+	EventSource src;
+	int channel_no; /* as numbered by the client */
+	int is_open;
+	int is_broken; /* sending failed, the channel is dropped once the current event is handled */
+	Impairer impair; /* simulated link the received packets go through */
+	struct session* session;
+} Channel;
+
+/* A transfer from a client, made of the channels announcing the same session ID */
+typedef struct session {
+	uint64_t session_id;
+	Hello params;
+	char path[PATH_MAX]; /* of the output file, or the root directory of a tree */
+	char checkpoint_path[PATH_MAX]; /* of the sidecar file of the checkpoints */
+	int reorder_capacity; /* no. of packets the reorder buffer must hold */
+	int use_uring; /* write the file through io_uring */
+	int positional; /* write packets at their offsets as they arrive */
+	uint32_t start_digest; /* CRC32C of the stream before the offset the transfer starts at */
+	Channel* channels; /* indexed by channel no. */
+	int num_joined; /* channels connected so far */
+	int num_open; /* channels not closed yet */
+	Receiver rcv;
+	struct worker* worker;
+	const char* error; /* ended the transfer, NULL if none */
+	int is_closing; /* the file is complete, waiting for the client to close the channels */
+	Timer close_timer; /* while closing, or while no channel is open */
+	uint64_t join_deadline; /* monotonic time by which all the channels must have joined */
+	int is_claimed; /* the destination is claimed by the session */
+	int is_abandoned; /* no channel is open, protected by the lock of the destinations */
+	int is_taken_over; /* to be ended for a new session of the same file, protected by the lock of the destinations */
+	struct session* next; /* in the list of the acceptor or the worker owning it */
+	struct session* next_claim; /* in the list of the destinations claimed */
+} Session;
+
+/*
+ * Destinations written by the pending and running sessions, so that no two
+ * sessions write the same output and checkpoint files. Claimed by the acceptor
+ * and released by the worker that ends the session. A session left without
+ * channels may be taken over by a new session of the same file, e.g. when
+ * its client resumes the transfer before the old one has timed out.
+ */
+typedef struct destinations {
+	pthread_mutex_t lock;
+	pthread_cond_t released; /* signalled when a destination is released */
+	Session* claimed; /* sessions claiming a destination, protected by lock */
+} Destinations;
+
+/* A new connection replacing a broken channel of a running session */
+typedef struct rejoin {
+	Connection conn; /* non-blocking, waiting for the reply to its REJOIN */
+	int channel_no;
+	Hello params; /* as proposed */
+	struct rejoin* next;
+} Rejoin;
+
+/*
+ * A thread serving the sessions handed to it by the acceptor on its own event
+ * loop, so that sessions on different workers never share any state
+ */
+typedef struct worker {
+	pthread_t thread;
+	EventLoop loop;
+	TimerWheel timers;
+	EventSource wakeup; /* eventfd signalled when a session is handed over */
+	pthread_mutex_t lock;
+	Session* handoff; /* sessions handed over but not yet started, protected by lock */
+	Rejoin* rejoins; /* channels handed over to rejoin a session, protected by lock */
+	Session* sessions; /* sessions running on the worker */
+	Session* dead; /* sessions ended during the current batch of events */
+	const ImpairConfig* impair; /* impairments of the received packets, per channel no. */
+	TraceRing* trace; /* trace of the packets of the worker's sessions, NULL unless a trace file is written */
+	Destinations* destinations; /* shared with the acceptor and the other workers */
+	int verbosity; /* VERBOSITY_QUIET, ... */
+} Worker;
+
+/**
+ * Claims the destination of a session, unless another session has claimed it.
+ * A session of the same file that has no channel open is ended by its worker,
+ * which saves its progress, and the destination is claimed once released.
+ * @param d	The destinations
+ * @param s	The session
+ *
+ * @return 0 on success, -1 if the destination is in use (errno is set)
  */
-void print_packet(Packet* pkt) {
-	switch(pkt->data_or_ack) {
-		case 0: {
-			/* data packet sent */
-			printf("RCVD PKT: Seq No. %d of size %ld bytes via channel %d\n", pkt->seq_no, pkt->payload_size, pkt->channel_no);
+int claim_destination(Destinations* d, Session* s) {
+	uint64_t one = 1;
+	pthread_mutex_lock(&d->lock);
+	for(;;) {
+		Session* other = d->claimed;
+		while(other != NULL && strcmp(other->params.name, s->params.name) != 0) {
+			other = other->next_claim;
+		}
+		if(other == NULL) {
+			break;
+		}
+		if(!other->is_taken_over && (!other->is_abandoned || other->params.file_id != s->params.file_id)) {
+			pthread_mutex_unlock(&d->lock);
+			errno = EBUSY;
+			return -1;
+		}
+		if(!other->is_taken_over) {
+			other->is_taken_over = 1;
+			if(write(other->worker->wakeup.fd, &one, sizeof(one)) < 0) {
+				report_error("Failed to wake up worker");
+			}
+		}
+		pthread_cond_wait(&d->released, &d->lock);
+	}
+	s->next_claim = d->claimed;
+	d->claimed = s;
+	s->is_claimed = 1;
+	pthread_mutex_unlock(&d->lock);
+	return 0;
+}
+
+/**
+ * Marks whether a running session has no channel open, which lets a new
+ * session of the same file take it over
+ * @param d				The destinations
+ * @param s				The session
+ * @param is_abandoned	1 if no channel is open, 0 otherwise
+ */
+void set_abandoned(Destinations* d, Session* s, int is_abandoned) {
+	pthread_mutex_lock(&d->lock);
+	s->is_abandoned = is_abandoned;
+	pthread_mutex_unlock(&d->lock);
+}
+
+/**
+ * Checks whether a new session of the same file takes a session over
+ * @param d	The destinations
+ * @param s	The session
+ *
+ * @return 1 if it does, 0 otherwise
+ */
+int is_taken_over(Destinations* d, Session* s) {
+	pthread_mutex_lock(&d->lock);
+	int is_taken_over = s->is_taken_over;
+	pthread_mutex_unlock(&d->lock);
+	return is_taken_over;
+}
+
+/**
+ * Releases the destination of a session once it writes nothing more to it
+ * @param d	The destinations
+ * @param s	The session, which may have released it already
+ */
+void release_destination(Destinations* d, Session* s) {
+	if(!s->is_claimed) {
+		return;
+	}
+	pthread_mutex_lock(&d->lock);
+	Session** link = &d->claimed;
+	while(*link != s) {
+		link = &(*link)->next_claim;
+	}
+	*link = s->next_claim;
+	s->is_claimed = 0;
+	pthread_cond_broadcast(&d->released);
+	pthread_mutex_unlock(&d->lock);
+}
+
+/**
+ * Records a packet in the trace, and prints it to the console at the
+ * highest verbosity
+ * @param ch	The channel on which the packet was received or sent
+ * @param type	TRACE_RECEIVE, TRACE_ACK_SENT, ...
+ * @param pkt	The packet
+ */
+void trace_packet(Channel* ch, int type, Packet* pkt) {
+	Worker* w = ch->session->worker;
+	uint32_t size = (type == TRACE_ACK_SENT) ? pkt->payload_size / SACK_BLOCK_SIZE : pkt->payload_size;
+	trace_record(w->trace, type, ch->session->session_id, ch->channel_no, pkt->seq_no, size, pkt->is_last);
+	if(w->verbosity < VERBOSITY_PACKETS) {
+		return;
+	}
+	switch(type) {
+		case TRACE_RECEIVE: {
+			/* data packet received */
+			printf("RCVD PKT: Seq No. %" PRIu64 " of size %" PRIu32 " bytes via channel %d\n", pkt->seq_no, pkt->payload_size, pkt->channel_no);
 		}
 		break;
-		case 1: {
-			/* ack received */
-			printf("SENT ACK: for PKT with Seq No. %d via channel %d\n", pkt->seq_no, pkt->channel_no);
+		case TRACE_ACK_SENT: {
+			/* cumulative ack sent, along with the ranges received out of order */
+			printf("SENT ACK: up to Seq No. %" PRIu64 " with %d SACK blocks via channel %d\n", pkt->seq_no,
+				(int) (pkt->payload_size / SACK_BLOCK_SIZE), pkt->channel_no);
 		}
 		break;
 	}
 }
 
 /**
- * Function to report an error and terminate the program
- * @param str	The error message
+ * Sends an acknowledgement and traces it. A failure marks the channel
+ * as broken, it is dropped once the current event has been handled.
+ * @param ch	The channel on which the acknowledgement is to be sent
+ * @param ack	The acknowledgement packet
  */
-void report_error(char* str) {
-	perror(str);
-	printf("Terminating program\n");
-	exit(0);
+void send_ack(Channel* ch, Packet* ack) {
+	if(conn_send_packet(&ch->conn, ack) < 0) {
+		perror("Failed to send acknowledgement");
+		ch->is_broken = 1;
+		return;
+	}
+
+	/* trace the sent acknowledgement */
+	trace_packet(ch, TRACE_ACK_SENT, ack);
 }
 
 /**
- * randomly generates either 0, indicating accept, or 
- * generates 1, indicating drop. The rate is determined
- * by the rate specified in the macro PACKET_DROP_RATE
+ * Sends a cumulative acknowledgement of everything received so far, along
+ * with the ranges held in the out-of-order buffer, on the channel of the
+ * latest data packet
+ * @param rcv	The receiver
  */
-int accept_or_drop() {
-	int rand_till_100 = rand() % 100;
-	return ((rand_till_100 < PACKET_DROP_RATE) ? 1 : 0);
+void send_pending_ack(Receiver* rcv) {
+	timer_cancel(rcv->timers, &rcv->ack_timer);
+	rcv->acks_pending = 0;
+
+	SackBlock blocks[MAX_SACK_BLOCKS];
+	unsigned char payload[MAX_SACK_BLOCKS * SACK_BLOCK_SIZE];
+	int num_blocks = reorder_sack(&rcv->reorder, blocks, MAX_SACK_BLOCKS);
+	encode_sack(blocks, num_blocks, payload);
+
+	Packet ack;
+	create_packet(&ack, rcv->reorder.next_seq, 0);
+	ack.payload = (char*) payload;
+	ack.payload_size = num_blocks * SACK_BLOCK_SIZE;
+	if(rcv->is_last_ackd) {
+		/* the client checks the whole stream against the digest */
+		ack.is_last = 1;
+		ack.checksum = rcv->reorder.digest;
+	}
+
+	/* the ACK is cumulative, so any channel serves, use the one that was last active */
+	struct channel* ch = rcv->ack_channel;
+	if(ch == NULL || !ch->is_open || ch->is_broken) {
+		return;
+	}
+	ack.channel_no = ch->channel_no;
+	send_ack(ch, &ack);
 }
 
 /**
- * Writes all the packets in the buffer to an output file
- * and clears the buffer
- * @param fp			Pointer to the output file
- * @param buffer		The buffer storing packets (assumed
- * 						to be in sorted order)
- * @param buf_filled	No. of packets in theh buffer
- * 
- * @return The total data written
+ * Accounts for a data packet to be acknowledged. The ACK is sent right away
+ * once enough packets are pending or the transfer is complete, otherwise it
+ * is delayed by at most ACK_DELAY_USEC to be coalesced with later ones.
+ * @param ch	The channel on which the packet was received
  */
-int buffer_flush(FILE* fp, Packet* buffer, int* buf_filled, int expected_seq) {
-	int i;
-	/* flush buffer contents */
-	for(i = 0; i < *buf_filled; i++) {
-		if(buffer[i].seq_no == expected_seq) {
-			fwrite(buffer[i].payload, 1, buffer[i].payload_size, fp);
-			expected_seq += buffer[i].payload_size;
+void schedule_ack(Channel* ch) {
+	Receiver* rcv = &ch->session->rcv;
+	rcv->ack_channel = ch;
+	rcv->acks_pending++;
+	if(rcv->acks_pending >= rcv->ack_every || rcv->is_last_ackd) {
+		send_pending_ack(rcv);
+	} else if(rcv->acks_pending == 1) {
+		timer_arm(rcv->timers, &rcv->ack_timer, ACK_DELAY_USEC);
+	}
+}
+
+/**
+ * Writes a data packet to the output, at its offset in positional mode and
+ * appended to the stream otherwise
+ * @param rcv	The receiver
+ * @param pkt	The packet
+ *
+ * @return 0 on success, -1 on failure
+ */
+int write_packet(Receiver* rcv, Packet* pkt) {
+	if(rcv->is_positional) {
+		return output_write_at(&rcv->out, pkt->payload, pkt->payload_size, pkt->seq_no);
+	}
+	return output_append(&rcv->out, pkt->payload, pkt->payload_size);
+}
+
+/**
+ * Handles a data packet received on a channel: writes or buffers it and
+ * acknowledges it
+ * @param ch	The channel on which the packet was received
+ * @param pkt	The received packet
+ */
+void handle_packet(Channel* ch, Packet* pkt) {
+	Receiver* rcv = &ch->session->rcv;
+
+	if(pkt->type != PKT_DATA) {
+		/* parameters are only negotiated at connection start */
+		return;
+	}
+
+	if(pkt->is_compressed) {
+		/* the rest of the handling only sees the data, as checksummed by the client */
+		uint32_t packet_size = ch->session->params.packet_size;
+		if(rcv->inflated == NULL && (rcv->inflated = malloc(packet_size)) == NULL) {
+			return;
 		}
+		int size = decompress_block(pkt->payload, pkt->payload_size, rcv->inflated, packet_size);
+		if(size < 0) {
+			/* damaged beyond decompressing, the client retransmits it once it is missed */
+			rcv->corrupted++;
+			trace_packet(ch, TRACE_CORRUPT, pkt);
+			return;
+		}
+		rcv->decompressed++;
+		rcv->wire_bytes += pkt->payload_size;
+		rcv->inflated_bytes += size;
+		pkt->payload = rcv->inflated;
+		pkt->payload_size = size;
+	}
+
+	if(pkt->seq_no + pkt->payload_size > ch->session->params.file_size) {
+		/* beyond the end of the file announced by the client */
+		return;
 	}
-	
-	/* compress buffer */
-	for(int j = 0; j < *buf_filled - i; j++) {
-		buffer[j] = buffer[i + j];
+
+	if(pkt->seq_no < rcv->reorder.next_seq) {
+		/* retransmitted packet that was already written, its ack was late. Ack again */
+		rcv->duplicates++;
+		trace_packet(ch, TRACE_DUPLICATE, pkt);
+		schedule_ack(ch);
+		return;
 	}
-	*buf_filled = *buf_filled - i;
 
-	return expected_seq;
+	if(crc32c(0, pkt->payload, pkt->payload_size) != pkt->checksum) {
+		/* damaged on the way, the client retransmits it once it is missed */
+		rcv->corrupted++;
+		trace_packet(ch, TRACE_CORRUPT, pkt);
+		return;
+	}
+
+	int status = 0;
+	if(pkt->seq_no == rcv->reorder.next_seq) {
+		/* write in-order packet to file, along with any out-of-order packets it was holding up */
+		reorder_skip(&rcv->reorder, pkt->payload_size, pkt->checksum);
+		if(write_packet(rcv, pkt) < 0 || reorder_flush(&rcv->reorder, &rcv->out) < 0) {
+			status = -1;
+		}
+	} else {
+		int held = reorder_insert(&rcv->reorder, pkt->seq_no, pkt->payload, pkt->payload_size, pkt->checksum);
+		if(held < 0) {
+			/* drop packet beyond the reorder buffer, it will be retransmitted */
+			return;
+		}
+		if(held == 0) {
+			rcv->duplicates++;
+			trace_packet(ch, TRACE_DUPLICATE, pkt);
+		} else {
+			trace_packet(ch, TRACE_REORDER, pkt);
+			if(rcv->reorder.num_held > rcv->max_held) {
+				rcv->max_held = rcv->reorder.num_held;
+			}
+		}
+		if(held == 1 && rcv->is_positional) {
+			/* no need to wait for the packets before it */
+			status = write_packet(rcv, pkt);
+		}
+	}
+	if(status < 0) {
+		perror("Failed to write output file");
+		ch->session->error = "failed to write output file";
+		return;
+	}
+
+	/* trace the received packet */
+	trace_packet(ch, TRACE_RECEIVE, pkt);
+
+	if(pkt->is_last) {
+		/* last packet received */
+		rcv->is_last_rcvd = 1;
+		rcv->last_end = pkt->seq_no + pkt->payload_size;
+	}
+
+	if(rcv->is_last_rcvd && rcv->reorder.next_seq >= rcv->last_end) {
+		/* all packets have been received by server */
+		rcv->is_last_ackd = 1;
+	}
+
+	/* acknowledge, possibly along with later packets */
+	schedule_ack(ch);
 }
 
 /**
- * Inserts a packet into the buffer in sorted order (assumes that the buffer
- * has sufficient capacity for one more element)
- * @param pkt		The packet to be inserted into the buffer
- * @param buffer	The buffer into which the packet is to be inserted
- * @param buf_size	The no. of elements already in the buffer
+ * Closes the connection of a channel
+ * @param ch	The channel
  */
-void insert_packet_to_buffer(Packet pkt, Packet* buffer, int* buf_size) {
-	int i = (*buf_size) - 1;
-	while(i >= 0 && buffer[i].seq_no > pkt.seq_no) {
-		buffer[i+1] = buffer[i];
-		i--;
+void close_channel(Channel* ch) {
+	event_loop_del(&ch->session->worker->loop, &ch->src);
+	close(ch->conn.fd);
+	conn_destroy(&ch->conn);
+	impair_destroy(&ch->impair);
+	ch->is_open = 0;
+	ch->session->num_open--;
+}
+
+/**
+ * Ends a session: closes the channels still open and the output file. The
+ * session is freed only after the current batch of events, which may still
+ * refer to its channels.
+ * @param s	The session
+ */
+void end_session(Session* s) {
+	Worker* w = s->worker;
+	timer_cancel(&w->timers, &s->rcv.ack_timer);
+	timer_cancel(&w->timers, &s->close_timer);
+	timer_cancel(&w->timers, &s->rcv.checkpoint_timer);
+	timer_cancel(&w->timers, &s->rcv.stats_timer);
+	checkpoint_close(&s->rcv.checkpoint);
+	for(int i = 0; i < s->params.num_channels; i++) {
+		if(s->channels[i].is_open) {
+			close_channel(&s->channels[i]);
+		}
+	}
+	reorder_destroy(&s->rcv.reorder);
+	free(s->rcv.inflated);
+	s->rcv.inflated = NULL;
+	if(s->rcv.is_out_open) {
+		output_close(&s->rcv.out);
+		s->rcv.is_out_open = 0;
 	}
-	buffer[i+1] = pkt;
-	(*buf_size) = (*buf_size) + 1;
+	release_destination(w->destinations, s);
+	Session** link = &w->sessions;
+	while(*link != NULL && *link != s) {
+		link = &(*link)->next;
+	}
+	if(*link == s) {
+		*link = s->next;
+	}
+	s->next = w->dead;
+	w->dead = s;
 }
 
-int main() {
-	/* set seed for random number generation */
-	srand(time(0));
+/**
+ * Saves the progress of the transfer of a session, after handing everything
+ * written in order so far to the kernel
+ * @param s	The session
+ *
+ * @return 0 on success, -1 on failure
+ */
+int save_checkpoint(Session* s) {
+	Receiver* rcv = &s->rcv;
+	if(!rcv->is_out_open || rcv->checkpoint.fd < 0) {
+		return 0;
+	}
+	if(output_sync(&rcv->out) < 0) {
+		return -1;
+	}
+	return checkpoint_save(&rcv->checkpoint, rcv->reorder.next_seq, rcv->reorder.digest,
+		rcv->out.entries != NULL ? rcv->out.manifest : NULL);
+}
 
-	/* create a socket */
-	int listen_sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if(listen_sock < 0) {
-		report_error("Failed to create socket");
+/**
+ * Timer handler of the periodic checkpoints of a session
+ * @param timer	The expired timer
+ * @param arg	The session
+ */
+void on_checkpoint_timeout(Timer* timer, void* arg) {
+	Session* s = arg;
+	if(save_checkpoint(s) < 0) {
+		perror("Failed to save checkpoint");
 	}
+	timer_arm(&s->worker->timers, timer, (uint64_t) CHECKPOINT_INTERVAL_MS * 1000);
+}
 
-	/* Create address structure */
-	struct sockaddr_in server_addr;
-	server_addr.sin_family = AF_INET;
-	server_addr.sin_port = htons(SERVER_PORT);
-	server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+/**
+ * Timer handler printing the progress of a session, rearms itself
+ * @param timer	The expired timer
+ * @param arg	The session
+ */
+void on_stats_timeout(Timer* timer, void* arg) {
+	Session* s = arg;
+	Receiver* rcv = &s->rcv;
+	printf("Session %016" PRIx64 ": %" PRIu64 " of %" PRIu64 " bytes received (%.1f%%), reorder buffer %" PRIu32 " of %" PRIu32 " (max %" PRIu32 "), %lu duplicates\n",
+		s->session_id, rcv->reorder.next_seq, s->params.file_size,
+		(s->params.file_size > 0) ? rcv->reorder.next_seq * 100.0 / s->params.file_size : 100.0,
+		rcv->reorder.num_held, rcv->reorder.capacity, rcv->max_held, rcv->duplicates);
+	timer_arm(&s->worker->timers, timer, (uint64_t) STATS_INTERVAL_MS * 1000);
+}
 
-	/* Allow socket descriptor to be usable */
-	int i = 1;
-	if(setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, (char*) &i, sizeof(i)) < 0) {
-		report_error("Failed to make socket reusable");
+/**
+ * Ends a session whose transfer could not be completed, the output is left as
+ * far as it was received and its progress is saved for resuming
+ * @param s		The session
+ * @param msg	The reason
+ */
+void fail_session(Session* s, const char* msg) {
+	printf("Session %016" PRIx64 ": %s, transfer of %s aborted\n", s->session_id, msg, s->path);
+	if(s->rcv.checkpoint.fd >= 0) {
+		if(save_checkpoint(s) < 0) {
+			perror("Failed to save checkpoint");
+		} else {
+			printf("Session %016" PRIx64 ": %" PRIu64 " bytes saved for resuming\n", s->session_id,
+				s->rcv.checkpoint.next_seq);
+		}
 	}
+	end_session(s);
+}
 
-	/* binding server socket */
-	if(bind(listen_sock, (struct sockaddr*) &server_addr, sizeof(server_addr)) < 0) {
-		report_error("Failed to bind the socket");
+/**
+ * Drops a broken channel of a running session, the client is expected to
+ * replace it. A session left without any channel fails unless one rejoins in
+ * time.
+ * @param ch		The channel
+ * @param reason	Why the channel is dropped
+ */
+void drop_channel(Channel* ch, const char* reason) {
+	Session* s = ch->session;
+	printf("Session %016" PRIx64 ": channel %d dropped, %s\n", s->session_id, ch->channel_no, reason);
+	close_channel(ch);
+	if(s->num_open == 0) {
+		set_abandoned(s->worker->destinations, s, 1);
+		timer_arm(&s->worker->timers, &s->close_timer, (uint64_t) REJOIN_TIMEOUT_MS * 1000);
 	}
+}
 
-	int fds[2]; /* stores two channels */
+/**
+ * Sends the final acknowledgement of a complete session, which carries the
+ * digest of the stream for the client to verify
+ * @param ch	The channel on which it is sent
+ */
+void send_final_ack(Channel* ch) {
+	Receiver* rcv = &ch->session->rcv;
+	Packet ack;
+	create_packet(&ack, rcv->reorder.next_seq, ch->channel_no);
+	ack.is_last = 1;
+	ack.checksum = rcv->reorder.digest;
+	send_ack(ch, &ack);
+}
 
-	/* listen for two connections (mimics two channels) */
-	for(i = 0; i < 2; i++) {
-		if(listen(listen_sock, MAX_PENDING) < 0) {
-			report_error("Failed to setup listening mode of socket");
+/**
+ * Serves a channel of a closing session until the client closes it. A data
+ * packet still arriving means that the client has not got the final
+ * acknowledgement, which is sent again and gives the client more time.
+ * @param ch	The channel
+ */
+void serve_closing_channel(Channel* ch) {
+	Session* s = ch->session;
+	Packet pkt;
+	int status = 0;
+	while(!ch->is_broken && (status = impair_recv_packet(&ch->impair, &ch->conn, &pkt)) == 1) {
+		if(pkt.type == PKT_DATA) {
+			send_final_ack(ch);
+			timer_arm(&s->worker->timers, &s->close_timer, (uint64_t) CLOSE_TIMEOUT_MS * 1000);
 		}
-		if((fds[i] = accept(listen_sock, NULL, NULL)) < 0) {
-			report_error("Failed to accept incoming connection");
+	}
+	if(ch->is_broken || status < 0) {
+		close_channel(ch);
+		if(s->num_open == 0) {
+			end_session(s);
 		}
 	}
+}
 
-	/* buffer for managing out-of-order packets */
-	Packet buffer[TMP_BUFFER_SIZE];
-	int expected_seq = 0;
-	int buf_filled = 0;
-
-	FILE* fptr = fopen("output.txt", "w");
+/**
+ * Timer handler of a closing session, closes the channels the client has not
+ * closed in time. A running session has been left without channels for too
+ * long and fails.
+ * @param timer	The expired timer
+ * @param arg	The session
+ */
+void on_close_timeout(Timer* timer, void* arg) {
+	Session* s = arg;
+	if(s->is_closing) {
+		end_session(s);
+	} else {
+		fail_session(s, "no channel rejoined in time");
+	}
+}
 
-	int is_last_ackd = 0;
-	int last_seq = __INT_MAX__;
+/**
+ * Completes a session once the whole file has been received: lets every
+ * channel know and waits for the client to close them
+ * @param s	The session
+ */
+void finish_session(Session* s) {
+	Receiver* rcv = &s->rcv;
+	if(output_flush(&rcv->out) < 0) {
+		perror("Failed to write output file");
+		fail_session(s, "failed to write output file");
+		return;
+	}
+	checkpoint_remove(&rcv->checkpoint);
 
-	while(is_last_ackd == 0) {
-		fd_set read_fds;
-		FD_ZERO(&read_fds);
-		FD_SET(fds[0], &read_fds);
-		FD_SET(fds[1], &read_fds);
+	/* another transfer may write the destination while the client closes the channels */
+	release_destination(s->worker->destinations, s);
+	unsigned long recv_calls = 0, send_calls = 0;
+	unsigned long dropped = 0, duplicated = 0, reordered = 0, corrupted = 0;
+	int is_impaired = 0;
+	for(int i = 0; i < s->params.num_channels; i++) {
+		Channel* ch = &s->channels[i];
+		recv_calls += ch->conn.recv_calls;
+		send_calls += ch->conn.send_calls;
+		dropped += ch->impair.dropped;
+		duplicated += ch->impair.duplicated;
+		reordered += ch->impair.reordered;
+		corrupted += ch->impair.corrupted;
+		is_impaired |= ch->impair.is_active;
+	}
+	Writer* writer = &rcv->out.writer;
+	if(rcv->out.is_tree) {
+		printf("Session %016" PRIx64 ": tree received successfully, %d files stored in %s (%lu recv, %lu send and %lu write calls%s)\n",
+			s->session_id, rcv->out.num_entries, s->path, recv_calls, send_calls, writer->write_calls,
+			writer->use_uring ? " with io_uring" : (writer->use_thread ? " by a writer thread" : ""));
+	} else {
+		printf("Session %016" PRIx64 ": file received successfully, stored as %s (%lu recv, %lu send and %lu write calls%s)\n",
+			s->session_id, s->path, recv_calls, send_calls, writer->write_calls,
+			writer->use_uring ? " with io_uring" : (writer->use_thread ? " by a writer thread" : ""));
+	}
+	printf("Session %016" PRIx64 ": up to %" PRIu32 " of %" PRIu32 " packets held for reordering, %lu duplicates, %lu corrupted, CRC32C %08" PRIx32 "\n",
+		s->session_id, rcv->max_held, rcv->reorder.capacity, rcv->duplicates, rcv->corrupted, rcv->reorder.digest);
+	if(rcv->decompressed > 0) {
+		printf("Session %016" PRIx64 ": %lu packets arrived compressed, %" PRIu64 " bytes decompressed into %" PRIu64 "\n",
+			s->session_id, rcv->decompressed, rcv->wire_bytes, rcv->inflated_bytes);
+	}
+	if(is_impaired) {
+		printf("Session %016" PRIx64 ": the simulated link dropped %lu, duplicated %lu, reordered %lu and corrupted %lu packets\n",
+			s->session_id, dropped, duplicated, reordered, corrupted);
+	}
 
-		if(select(fds[1] + 1, &read_fds, NULL, NULL, NULL) <= 0) {
-			report_error("Error occurred in select()");
+	/*
+	 * let every other channel know that the transfer is complete, the client
+	 * closes the channels once it has got the final acknowledgement on any
+	 */
+	s->is_closing = 1;
+	for(int i = 0; i < s->params.num_channels; i++) {
+		Channel* ch = &s->channels[i];
+		if(!ch->is_open) {
+			continue;
 		}
-		/* select returned a positive value, some fd is set */
-		if(FD_ISSET(fds[0], &read_fds)) {
-			Packet pkt;
-			memset(&pkt, 0, sizeof(Packet));
-			int status;
-			if((status = recv(fds[0], &pkt, sizeof(Packet), 0)) < 0) {
-				report_error("Failed to receive packet");
-			} else if(status == 0) {
-				printf("Connection closed by client.\nTerminating program\n");
-				exit(0);
-			}
+		if(ch != rcv->ack_channel) {
+			send_final_ack(ch);
+		}
+		if(ch->is_broken) {
+			close_channel(ch);
+		}
+	}
+	if(s->num_open == 0) {
+		end_session(s);
+	} else {
+		timer_arm(&s->worker->timers, &s->close_timer, (uint64_t) CLOSE_TIMEOUT_MS * 1000);
+	}
+}
 
-			if(accept_or_drop() != 1) {
-				/* packet should not be dropped randomly */
-				if(pkt.seq_no < expected_seq) {
-					/* must be retransmitted packet due to timeout, but was ack'd. Drop silently */
-				} else if(pkt.seq_no == expected_seq) {
-					/* print trace of received packet */
-					print_packet(&pkt);
-
-					/* send acknowledgement */
-					Packet ack = create_packet(pkt.seq_no, pkt.channel_no);
-					
-					if(pkt.is_last) {
-						/* last packet received */
-						last_seq = pkt.seq_no;
-					}
-
-					if(expected_seq >= last_seq) {
-						/* all packets have been received by server */
-						ack.is_last = 1;
-						is_last_ackd = 1;
-					}
-
-					if(send(fds[0], &ack, sizeof(Packet), 0) < 0) {
-						report_error("Failed to send acknowledgement");
-					}
-
-					/* print trace of sent acknowledgement */
-					print_packet(&ack);
-
-					/* write in-order packet to file */
-					fwrite(pkt.payload, 1, pkt.payload_size, fptr);
-
-					/* update expected sequence number for in-order packet */
-					expected_seq += pkt.payload_size;
-
-					/* write any out-of-order packets to file */
-					expected_seq = buffer_flush(fptr, buffer, &buf_filled, expected_seq);
-				} else if(buf_filled < TMP_BUFFER_SIZE) {
-					/* out-of-order packet to be accepted */
-					/* print trace of received packet */
-					print_packet(&pkt);
-
-					/* send acknowledgement */
-					Packet ack = create_packet(pkt.seq_no, pkt.channel_no);
-
-					if(pkt.is_last) {
-						/* last packet received */
-						ack.is_last = 1;
-						is_last_ackd = 1;
-					}
-
-					if(send(fds[0], &ack, sizeof(Packet), 0) < 0) {
-						report_error("Failed to send acknowledgement");
-					}
-
-					/* print trace of sent acknowledgement */
-					print_packet(&ack);
-
-					/* insert packet into buffer */
-					insert_packet_to_buffer(pkt, buffer, &buf_filled);
-				} /* otherwise drop packet due to filled buffer */
-			} /* packet dropped randomly */
-		}
-		if(FD_ISSET(fds[1], &read_fds)) {
-			Packet pkt;
-			memset(&pkt, 0, sizeof(Packet));
-			int status;
-			if((status = recv(fds[1], &pkt, sizeof(Packet), 0)) < 0) {
-				report_error("Failed to receive packet");
-			} else if(status == 0) {
-				printf("Connection closed by client.\nTerminating program\n");
-				exit(0);
+/**
+ * Timer handler of the delayed acknowledgement
+ * @param timer	The expired timer
+ * @param arg	The session
+ */
+void on_ack_timeout(Timer* timer, void* arg) {
+	Session* s = arg;
+	if(s->rcv.acks_pending > 0) {
+		send_pending_ack(&s->rcv);
+	}
+	Channel* ch = s->rcv.ack_channel;
+	if(s->error != NULL) {
+		fail_session(s, s->error);
+	} else if(ch != NULL && ch->is_open && ch->is_broken) {
+		drop_channel(ch, "failed to send");
+	}
+}
+
+/**
+ * Event loop handler of a channel, sends the queued packets and receives all
+ * the packets available on it
+ * @param fd		The channel's socket
+ * @param events	The events reported for the socket
+ * @param arg		The channel
+ */
+void on_channel_ready(int fd, uint32_t events, void* arg) {
+	Channel* ch = arg;
+	Session* s = ch->session;
+	Packet pkt;
+	int status = 0;
+
+	if(!ch->is_open) {
+		/* closed by an earlier event of the same batch */
+		return;
+	}
+
+	/* resume sending the packets queued while the socket was full */
+	if((events & EPOLLOUT) && conn_flush(&ch->conn) < 0) {
+		if(s->is_closing) {
+			close_channel(ch);
+			if(s->num_open == 0) {
+				end_session(s);
 			}
+		} else {
+			drop_channel(ch, "failed to send");
+		}
+		return;
+	}
+
+	if(s->is_closing) {
+		serve_closing_channel(ch);
+		return;
+	}
+
+	/* edge-triggered, so drain the socket completely */
+	while(s->rcv.is_last_ackd == 0 && s->error == NULL && !ch->is_broken &&
+		(status = impair_recv_packet(&ch->impair, &ch->conn, &pkt)) == 1) {
+		handle_packet(ch, &pkt);
+	}
+	if(s->error != NULL) {
+		fail_session(s, s->error);
+	} else if(s->rcv.is_last_ackd) {
+		finish_session(s);
+	} else if(ch->is_broken) {
+		drop_channel(ch, "failed to send");
+	} else if(status == -1) {
+		drop_channel(ch, "failed to receive packet");
+	} else if(status == -2) {
+		drop_channel(ch, "connection closed by client");
+	}
+}
+
+/**
+ * Timer handler of the impairer of a channel, receives the packets that have
+ * become due
+ * @param timer	The expired timer
+ * @param arg	The channel
+ */
+void on_impair_timeout(Timer* timer, void* arg) {
+	Channel* ch = arg;
+	on_channel_ready(ch->conn.fd, EPOLLIN, ch);
+}
+
+/**
+ * Starts watching a channel of a running session
+ * @param w		The worker running the session
+ * @param ch	The channel, connected
+ *
+ * @return 0 on success, -1 on failure
+ */
+int watch_channel(Worker* w, Channel* ch) {
+	impair_init(&ch->impair, &w->impair[ch->channel_no], ch->channel_no, &w->timers, on_impair_timeout, ch);
+	ch->impair.trace = w->trace;
+	ch->impair.session_id = ch->session->session_id;
+	ch->src.fd = ch->conn.fd;
+	ch->src.handler = on_channel_ready;
+	ch->src.arg = ch;
+	return event_loop_add(&w->loop, &ch->src, EPOLLIN | EPOLLOUT | EPOLLET);
+}
+
+/**
+ * Starts receiving the file or tree of a session whose channels have all joined
+ * @param w	The worker the session has been handed to
+ * @param s	The session
+ */
+void start_session(Worker* w, Session* s) {
+	Receiver* rcv = &s->rcv;
+	int num_channels = s->params.num_channels;
+	s->worker = w;
+	s->next = w->sessions;
+	w->sessions = s;
+	s->num_open = num_channels;
+	timer_init(&s->close_timer, on_close_timeout, s);
+	timer_init(&rcv->checkpoint_timer, on_checkpoint_timeout, s);
+	timer_init(&rcv->stats_timer, on_stats_timeout, s);
+	rcv->checkpoint.fd = -1;
+
+	rcv->timers = &w->timers;
+	timer_init(&rcv->ack_timer, on_ack_timeout, s);
+
+	/* acknowledge at least every half window, so that the client never stalls on a delayed ACK */
+	rcv->ack_every = (num_channels * s->params.window) / 2;
+	if(rcv->ack_every < 1) {
+		rcv->ack_every = 1;
+	} else if(rcv->ack_every > ACK_EVERY_PACKETS) {
+		rcv->ack_every = ACK_EVERY_PACKETS;
+	}
+
+	/* the files of a tree are only known once the manifest has arrived, so they are written in order */
+	rcv->is_positional = s->positional && s->params.manifest_size == 0;
+	uint64_t start = s->params.start_seq;
+	if(reorder_init(&rcv->reorder, start, s->start_digest, s->reorder_capacity, s->params.packet_size, !rcv->is_positional) < 0) {
+		fail_session(s, "failed to allocate reorder buffer");
+		return;
+	}
+
+	/* a tree resumed past its start gets its manifest from the checkpoint */
+	unsigned char* manifest = NULL;
+	if(start > 0 && s->params.manifest_size > 0) {
+		Checkpoint saved;
+		manifest = malloc(s->params.manifest_size);
+		if(manifest == NULL || checkpoint_load(&saved, s->checkpoint_path) < 0 ||
+			saved.manifest_size != s->params.manifest_size || checkpoint_load_manifest(&saved, manifest) < 0) {
+			free(manifest);
+			fail_session(s, "failed to read checkpoint");
+			return;
+		}
+	}
+	int status = output_open(&rcv->out, s->path, s->params.file_size, s->params.manifest_size, start, manifest,
+		s->use_uring);
+	free(manifest);
+	if(status < 0) {
+		fail_session(s, strerror(errno));
+		return;
+	}
+	rcv->is_out_open = 1;
+	if(rcv->is_positional && output_preallocate(&rcv->out) < 0) {
+		fail_session(s, strerror(errno));
+		return;
+	}
 
-			if(accept_or_drop() != 1) {
-				/* packet should not be dropped randomly */
-				if(pkt.seq_no < expected_seq) {
-					/* must be retransmitted packet due to timeout, but was ack'd. Drop silently */
-				} else if(pkt.seq_no == expected_seq) {
-					/* print trace of received packet */
-					print_packet(&pkt);
+	for(int i = 0; i < num_channels; i++) {
+		if(watch_channel(w, &s->channels[i]) < 0) {
+			fail_session(s, "failed to watch channel");
+			return;
+		}
+	}
 
-					/* send acknowledgement */
-					Packet ack = create_packet(pkt.seq_no, pkt.channel_no);
+	/* keep checkpoints of the progress, the transfer goes on without them if they cannot be written */
+	if(s->params.file_id != 0) {
+		if(checkpoint_open(&rcv->checkpoint, s->checkpoint_path, s->params.file_id, s->params.file_size,
+			s->params.manifest_size, start, s->start_digest) < 0) {
+			perror("Failed to create checkpoint");
+		} else {
+			timer_arm(&w->timers, &rcv->checkpoint_timer, (uint64_t) CHECKPOINT_INTERVAL_MS * 1000);
+		}
+	}
+	printf("Session %016" PRIx64 ": receiving %s%s (%" PRIu64 " bytes%s) over %d channels with a window of %d packets of %" PRIu32 " bytes\n",
+		s->session_id, rcv->out.is_tree ? "tree " : "", s->path, s->params.file_size,
+		rcv->is_positional ? ", positional writes" : "", num_channels,
+		s->params.window, s->params.packet_size);
+	if(start > 0) {
+		printf("Session %016" PRIx64 ": resuming at byte %" PRIu64 "\n", s->session_id, start);
+	}
+	if(w->verbosity >= VERBOSITY_PROGRESS) {
+		timer_arm(&w->timers, &rcv->stats_timer, (uint64_t) STATS_INTERVAL_MS * 1000);
+	}
+}
 
-					if(pkt.is_last) {
-						/* last packet received */
-						last_seq = pkt.seq_no;
-					}
+/**
+ * Releases the memory of a session, its channels must have been closed
+ * @param s	The session
+ */
+void free_session(Session* s) {
+	free(s->channels);
+	free(s);
+}
 
-					if(expected_seq >= last_seq) {
-						/* all packets have been received by server */
-						ack.is_last = 1;
-						is_last_ackd = 1;
-					}
+/**
+ * Lets the client know why its channel is not accepted, and closes the
+ * connection
+ * @param conn			The connection of the channel
+ * @param channel_no	The channel no. announced by the client
+ * @param reason		Why the channel is not accepted
+ */
+void refuse_channel(Connection* conn, int channel_no, const char* reason) {
+	Packet reply;
+	create_packet(&reply, 0, channel_no);
+	reply.type = PKT_REFUSE;
+	reply.payload = (char*) reason;
+	reply.payload_size = strlen(reason);
+	conn_send_packet(conn, &reply);
+	close(conn->fd);
+	conn_destroy(conn);
+}
 
-					if(send(fds[1], &ack, sizeof(Packet), 0) < 0) {
-						report_error("Failed to send acknowledgement");
-					}
+/**
+ * Puts a new connection in place of a broken channel of a running session
+ * and confirms the parameters of the session to the client
+ * @param w	The worker running the session
+ * @param r	The connection
+ */
+void rejoin_channel(Worker* w, Rejoin* r) {
+	Session* s = w->sessions;
+	while(s != NULL && s->session_id != r->params.session_id) {
+		s = s->next;
+	}
+	const char* error = NULL;
+	if(s == NULL || s->is_closing || is_taken_over(w->destinations, s)) {
+		error = "no such running session";
+	} else if(r->channel_no >= s->params.num_channels || r->params.file_id != s->params.file_id ||
+		r->params.file_size != s->params.file_size || strcmp(r->params.name, s->params.name) != 0) {
+		error = "channel does not match the session";
+	}
 
-					/* print trace of sent acknowledgement */
-					print_packet(&ack);
+	/* the reply fits into the send buffer of a new connection */
+	unsigned char payload[MAX_HELLO_SIZE];
+	Packet reply;
+	create_packet(&reply, 0, r->channel_no);
+	reply.type = PKT_HELLO;
+	reply.payload = (char*) payload;
+	if(error == NULL) {
+		reply.payload_size = encode_hello(&s->params, payload);
+		if(conn_send_packet(&r->conn, &reply) < 0 || r->conn.tx_count > 0) {
+			error = "failed to send HELLO";
+		}
+	}
+	if(error != NULL) {
+		fprintf(stderr, "Session %016" PRIx64 ": %s, rejoining channel rejected\n", r->params.session_id, error);
+		refuse_channel(&r->conn, r->channel_no, error);
+		return;
+	}
 
-					/* write in-order packet to file */
-					fwrite(pkt.payload, 1, pkt.payload_size, fptr);
+	/* the client has given up on the old connection, even if the server has not noticed yet */
+	Channel* ch = &s->channels[r->channel_no];
+	if(ch->is_open) {
+		close_channel(ch);
+	}
+	ch->conn = r->conn;
+	ch->conn.max_payload = s->params.packet_size;
+	ch->is_open = 1;
+	ch->is_broken = 0;
+	if(watch_channel(w, ch) < 0) {
+		close(ch->conn.fd);
+		conn_destroy(&ch->conn);
+		impair_destroy(&ch->impair);
+		ch->is_open = 0;
+		return;
+	}
+	if(s->num_open++ == 0) {
+		set_abandoned(w->destinations, s, 0);
+	}
+	timer_cancel(&w->timers, &s->close_timer);
+	printf("Session %016" PRIx64 ": channel %d rejoined\n", s->session_id, ch->channel_no);
+}
 
-					/* update expected sequence number for in-order packet */
-					expected_seq += pkt.payload_size;
+/**
+ * Event loop handler of a worker's eventfd, ends the sessions taken over,
+ * starts the sessions handed over by the acceptor and puts rejoining channels
+ * in place
+ * @param fd		The eventfd
+ * @param events	The events reported for the eventfd
+ * @param arg		The worker
+ */
+void on_handoff(int fd, uint32_t events, void* arg) {
+	Worker* w = arg;
+	uint64_t count;
+	while(read(fd, &count, sizeof(count)) > 0) {
+		/* reset the counter */
+	}
 
-					/* write any out-of-order packets to file */
-					expected_seq = buffer_flush(fptr, buffer, &buf_filled, expected_seq);
-				} else if(buf_filled < TMP_BUFFER_SIZE) {
-					/* out-of-order packet to be accepted */
-					/* print trace of received packet */
-					print_packet(&pkt);
+	pthread_mutex_lock(&w->lock);
+	Session* list = w->handoff;
+	Rejoin* rejoins = w->rejoins;
+	w->handoff = NULL;
+	w->rejoins = NULL;
+	pthread_mutex_unlock(&w->lock);
 
-					/* send acknowledgement */
-					Packet ack = create_packet(pkt.seq_no, pkt.channel_no);
+	/* the acceptor waits for the sessions taken over to release their destinations */
+	Session* s = w->sessions;
+	while(s != NULL) {
+		Session* next = s->next;
+		if(is_taken_over(w->destinations, s)) {
+			fail_session(s, "taken over by a new transfer of the same file");
+		}
+		s = next;
+	}
 
-					if(pkt.is_last) {
-						/* last packet received */
-						ack.is_last = 1;
-						is_last_ackd = 1;
-					}
+	while(list != NULL) {
+		Session* s = list;
+		list = list->next;
+		s->next = NULL;
+		start_session(w, s);
+	}
+	while(rejoins != NULL) {
+		Rejoin* r = rejoins;
+		rejoins = rejoins->next;
+		rejoin_channel(w, r);
+		free(r);
+	}
+}
 
-					if(send(fds[1], &ack, sizeof(Packet), 0) < 0) {
-						report_error("Failed to send acknowledgement");
-					}
+/**
+ * Main function of a worker thread, serves its sessions forever
+ * @param arg	The worker
+ *
+ * @return Never returns
+ */
+void* worker_main(void* arg) {
+	Worker* w = arg;
+	for(;;) {
+		/* wait for packets until the earliest delayed ACK or close timeout is due */
+		if(event_loop_run_once(&w->loop, timer_wheel_next_timeout_ms(&w->timers)) < 0) {
+			report_error("Error occurred in epoll_wait()");
+		}
+		timer_wheel_advance(&w->timers);
 
-					/* print trace of sent acknowledgement */
-					print_packet(&ack);
+		/* no event of the batch refers to the sessions that ended any more */
+		while(w->dead != NULL) {
+			Session* s = w->dead;
+			w->dead = s->next;
+			free_session(s);
+		}
+	}
+	return NULL;
+}
 
-					/* insert packet into buffer */
-					insert_packet_to_buffer(pkt, buffer, &buf_filled);
-				} /* otherwise drop packet due to filled buffer */
-			} /* packet dropped randomly */
+/**
+ * Creates a worker and starts its thread
+ * @param w		The worker
+ * @param impair	The impairments of the received packets, per channel no.
+ * @param trace		The trace ring of the worker, or NULL
+ * @param destinations	The destinations claimed by the sessions
+ * @param verbosity	Of the console output, VERBOSITY_QUIET, ...
+ */
+void start_worker(Worker* w, const ImpairConfig* impair, TraceRing* trace, Destinations* destinations, int verbosity) {
+	memset(w, 0, sizeof(Worker));
+	w->impair = impair;
+	w->trace = trace;
+	w->destinations = destinations;
+	w->verbosity = verbosity;
+	timer_wheel_init(&w->timers);
+	pthread_mutex_init(&w->lock, NULL);
+	if(event_loop_init(&w->loop) < 0) {
+		report_error("Failed to create event loop");
+	}
+
+	w->wakeup.fd = eventfd(0, EFD_NONBLOCK);
+	if(w->wakeup.fd < 0) {
+		report_error("Failed to create eventfd");
+	}
+	w->wakeup.handler = on_handoff;
+	w->wakeup.arg = w;
+	if(event_loop_add(&w->loop, &w->wakeup, EPOLLIN | EPOLLET) < 0) {
+		report_error("Failed to watch eventfd");
+	}
+
+	if(pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+		report_error("Failed to start worker thread");
+	}
+}
+
+/**
+ * Hands a session whose channels have all joined over to a worker
+ * @param w	The worker
+ * @param s	The session
+ */
+void hand_over(Worker* w, Session* s) {
+	uint64_t one = 1;
+	pthread_mutex_lock(&w->lock);
+	s->next = w->handoff;
+	w->handoff = s;
+	pthread_mutex_unlock(&w->lock);
+	if(write(w->wakeup.fd, &one, sizeof(one)) < 0) {
+		report_error("Failed to wake up worker");
+	}
+}
+
+/**
+ * Hands a channel rejoining a running session over to the worker of the session
+ * @param w	The worker
+ * @param r	The channel
+ */
+void hand_over_rejoin(Worker* w, Rejoin* r) {
+	uint64_t one = 1;
+	pthread_mutex_lock(&w->lock);
+	r->next = w->rejoins;
+	w->rejoins = r;
+	pthread_mutex_unlock(&w->lock);
+	if(write(w->wakeup.fd, &one, sizeof(one)) < 0) {
+		report_error("Failed to wake up worker");
+	}
+}
+
+/* Accepts the channels and groups them into sessions until all of them have joined */
+typedef struct acceptor {
+	int listen_sock;
+	EventLoop loop; /* of the listening socket and the connections waiting for their HELLO */
+	TimerWheel timers;
+	EventSource listener;
+	Timer expiry_timer; /* sweeps the pending sessions */
+	Session* pending; /* sessions some channels of which have not joined yet */
+	Worker* workers;
+	int num_workers;
+	const char* out_dir;
+	int reorder_capacity; /* as configured, 0 for a window per channel */
+	int use_uring; /* write the files through io_uring */
+	int positional; /* write packets at their offsets as they arrive */
+	ImpairConfig impair[MAX_CHANNELS]; /* impairments of the received packets, per channel no. */
+	int verbosity; /* of the console output, VERBOSITY_QUIET, ... */
+	const char* trace_path; /* file the packets are traced to, NULL for none */
+	Tracer tracer;
+	Destinations destinations; /* of the pending and running sessions */
+} Acceptor;
+
+/* A new connection whose HELLO has not been received yet */
+typedef struct joining {
+	Connection conn;
+	EventSource src;
+	Timer timeout; /* drops the connection if the HELLO takes too long */
+	Acceptor* acc;
+} Joining;
+
+/**
+ * Releases a session that has not been handed over to a worker
+ * @param acc	The acceptor
+ * @param s		The session
+ */
+void discard_session(Acceptor* acc, Session* s) {
+	release_destination(&acc->destinations, s);
+	for(int i = 0; i < s->params.num_channels; i++) {
+		if(s->channels[i].is_open) {
+			close(s->channels[i].conn.fd);
+			conn_destroy(&s->channels[i].conn);
 		}
 	}
+	free_session(s);
+}
+
+/**
+ * Discards the pending sessions whose channels have not all joined in time
+ * @param acc	The acceptor
+ */
+void expire_sessions(Acceptor* acc) {
+	uint64_t now = monotonic_usec();
+	Session** link = &acc->pending;
+	while(*link != NULL) {
+		Session* s = *link;
+		if(now < s->join_deadline) {
+			link = &s->next;
+			continue;
+		}
+		printf("Session %016" PRIx64 ": only %d of %d channels joined, discarded\n", s->session_id,
+			s->num_joined, s->params.num_channels);
+		*link = s->next;
+		discard_session(acc, s);
+	}
+}
+
+/**
+ * Decides on the parameters of the transfer proposed by the client, within
+ * the limits of the server
+ * @param proposed			The proposed parameters, updated to the accepted ones
+ * @param reorder_capacity	The no. of packets the reorder buffer can hold, 0
+ * 							if it is sized to the proposal
+ *
+ * @return 0 if the proposal is acceptable, -1 otherwise
+ */
+int accept_params(Hello* proposed, int reorder_capacity) {
+	if(proposed->num_channels < 1 || proposed->num_channels > MAX_CHANNELS || proposed->window < 1 ||
+		proposed->window > MAX_WINDOW || proposed->packet_size < 1) {
+		return -1;
+	}
+
+	/* the destination is a plain file (or directory) name within the output directory */
+	if(proposed->name[0] == '\0' || strchr(proposed->name, '/') != NULL || strcmp(proposed->name, ".") == 0 ||
+		strcmp(proposed->name, "..") == 0) {
+		return -1;
+	}
+
+	/* the manifest of a tree is collected in memory and is part of the stream */
+	if(proposed->manifest_size > 0 && (proposed->manifest_size < MANIFEST_HEADER_SIZE ||
+		proposed->manifest_size > MAX_MANIFEST_SIZE || proposed->manifest_size > proposed->file_size)) {
+		return -1;
+	}
+
+	if(proposed->packet_size > MAX_PACKET_SIZE) {
+		proposed->packet_size = MAX_PACKET_SIZE;
+	}
 
-	fclose(fptr);
-	printf("\nFile received successfully, stored as output.txt\n");
+	/*
+	 * shrink the window so that all the packets in flight fit into the reorder
+	 * buffer, a packet beyond it would be dropped on every retransmission
+	 */
+	if(reorder_capacity > 0 && proposed->num_channels * proposed->window > reorder_capacity) {
+		proposed->window = reorder_capacity / proposed->num_channels;
+		if(proposed->window < 1) {
+			proposed->window = 1;
+		}
+	}
 	return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * Creates a pending session for the first channel of a transfer to join
+ * @param acc		The acceptor
+ * @param params	The accepted parameters of the transfer
+ *
+ * @return The session, NULL if it could not be allocated or another session
+ * 			writes the same destination (errno is set)
+ */
+Session* create_session(Acceptor* acc, Hello* params) {
+	Session* s = calloc(1, sizeof(Session));
+	if(s == NULL) {
+		return NULL;
+	}
+	s->channels = calloc(params->num_channels, sizeof(Channel));
+	if(s->channels == NULL) {
+		free(s);
+		return NULL;
+	}
+	s->session_id = params->session_id;
+	s->params = *params;
+	snprintf(s->path, sizeof(s->path), "%s/%s", acc->out_dir, params->name);
+	snprintf(s->checkpoint_path, sizeof(s->checkpoint_path), "%s/.%s.ckpt", acc->out_dir, params->name);
+	if(claim_destination(&acc->destinations, s) < 0) {
+		free_session(s);
+		return NULL;
+	}
+
+	/* resume from the checkpoint of the same input, at a packet boundary short of the end */
+	uint64_t start = 0;
+	Checkpoint saved;
+	if(params->start_seq > 0 && params->file_id != 0 && checkpoint_load(&saved, s->checkpoint_path) == 0 &&
+		saved.file_id == params->file_id && saved.stream_size == params->file_size &&
+		saved.manifest_size == params->manifest_size && (saved.manifest_size == 0 || saved.has_manifest)) {
+		start = (params->start_seq < saved.next_seq) ? params->start_seq : saved.next_seq;
+		if(start >= params->file_size && params->file_size > 0) {
+			start = params->file_size - 1;
+		}
+		start -= start % params->packet_size;
+
+		/* the digest of the stream before the start is only known at the checkpointed offset */
+		if(start == saved.next_seq) {
+			s->start_digest = saved.digest;
+		} else {
+			start = 0;
+		}
+	}
+	s->params.start_seq = start;
+
+	/* every channel has at most a window of packets in flight, so the reorder buffer must hold a window per channel */
+	s->reorder_capacity = params->num_channels * params->window;
+	if(s->reorder_capacity < acc->reorder_capacity) {
+		s->reorder_capacity = acc->reorder_capacity;
+	}
+	s->use_uring = acc->use_uring;
+	s->positional = acc->positional;
+	s->join_deadline = monotonic_usec() + (uint64_t) JOIN_TIMEOUT_MS * 1000;
+	s->next = acc->pending;
+	acc->pending = s;
+	return s;
+}
+
+/**
+ * Releases a connection that has not sent its HELLO
+ * @param j	The connection
+ */
+void drop_joining(Joining* j) {
+	event_loop_del(&j->acc->loop, &j->src);
+	timer_cancel(&j->acc->timers, &j->timeout);
+	close(j->conn.fd);
+	conn_destroy(&j->conn);
+	free(j);
+}
+
+/**
+ * Timer handler of a connection whose HELLO has not arrived in time
+ * @param timer	The expired timer
+ * @param arg	The connection
+ */
+void on_hello_timeout(Timer* timer, void* arg) {
+	fprintf(stderr, "No HELLO received from client in time, connection dropped\n");
+	drop_joining(arg);
+}
+
+/**
+ * Timer handler sweeping the pending sessions, rearms itself
+ * @param timer	The expired timer
+ * @param arg	The acceptor
+ */
+void on_expiry_timeout(Timer* timer, void* arg) {
+	Acceptor* acc = arg;
+	expire_sessions(acc);
+	timer_arm(&acc->timers, timer, (uint64_t) EXPIRY_INTERVAL_MS * 1000);
+}
+
+/**
+ * Negotiates the parameters of the transfer over a channel whose HELLO has
+ * been received. The first channel of a session proposes the parameters,
+ * every other channel must propose the same ones. A session is handed over
+ * to a worker once all its channels have joined, always the same one for a
+ * session ID, so that channels replacing broken ones can follow it there.
+ * @param acc		The acceptor
+ * @param conn		The connection of the channel, which is taken over
+ * @param pkt		The HELLO or REJOIN received on it
+ * @param proposed	The parameters it proposes
+ */
+void join_channel(Acceptor* acc, Connection* conn, Packet* pkt, Hello* proposed) {
+	if(pkt->type == PKT_REJOIN) {
+		/* the session is running on the worker it was handed to, which checks and answers the channel */
+		Rejoin* r = malloc(sizeof(Rejoin));
+		if(r == NULL) {
+			perror("Failed to allocate rejoining channel");
+			close(conn->fd);
+			conn_destroy(conn);
+			return;
+		}
+		r->conn = *conn;
+		r->channel_no = pkt->channel_no;
+		r->params = *proposed;
+		hand_over_rejoin(&acc->workers[proposed->session_id % acc->num_workers], r);
+		return;
+	}
+
+	Session* s = acc->pending;
+	while(s != NULL && s->session_id != proposed->session_id) {
+		s = s->next;
+	}
+	const char* error = NULL;
+	if(accept_params(proposed, acc->reorder_capacity) < 0) {
+		error = "invalid parameters";
+	} else if(s == NULL && (s = create_session(acc, proposed)) == NULL) {
+		error = (errno == EBUSY) ? "destination in use by another transfer" : "failed to allocate session";
+	} else if(proposed->num_channels != s->params.num_channels || proposed->window != s->params.window ||
+		proposed->packet_size != s->params.packet_size || proposed->file_size != s->params.file_size ||
+		proposed->manifest_size != s->params.manifest_size || proposed->file_id != s->params.file_id || strcmp(proposed->name, s->params.name) != 0) {
+		error = "channels of the transfer proposed different parameters";
+	} else if(pkt->channel_no >= s->params.num_channels || s->channels[pkt->channel_no].is_open) {
+		error = "invalid channel no.";
+	}
+	if(error != NULL) {
+		fprintf(stderr, "Session %016" PRIx64 ": %s, connection rejected\n", proposed->session_id, error);
+		refuse_channel(conn, pkt->channel_no, error);
+		return;
+	}
+
+	/* answer with the accepted parameters, which fit into the send buffer of a new connection */
+	unsigned char payload[MAX_HELLO_SIZE];
+	Packet reply;
+	create_packet(&reply, 0, pkt->channel_no);
+	reply.type = PKT_HELLO;
+	reply.payload = (char*) payload;
+	reply.payload_size = encode_hello(&s->params, payload);
+	if(conn_send_packet(conn, &reply) < 0 || conn->tx_count > 0) {
+		fprintf(stderr, "Session %016" PRIx64 ": failed to send HELLO, connection rejected\n", proposed->session_id);
+		close(conn->fd);
+		conn_destroy(conn);
+		return;
+	}
+	conn->max_payload = s->params.packet_size;
+
+	Channel* ch = &s->channels[pkt->channel_no];
+	ch->conn = *conn;
+	ch->channel_no = pkt->channel_no;
+	ch->is_open = 1;
+	ch->session = s;
+	s->num_joined++;
+	if(s->num_joined < s->params.num_channels) {
+		return;
+	}
+
+	/* all channels have joined, the session is no longer the acceptor's */
+	Session** link = &acc->pending;
+	while(*link != s) {
+		link = &(*link)->next;
+	}
+	*link = s->next;
+	s->next = NULL;
+	hand_over(&acc->workers[s->session_id % acc->num_workers], s);
+}
+
+/**
+ * Event loop handler of a connection waiting for its HELLO, negotiates the
+ * transfer once the HELLO is complete
+ * @param fd		The connection's socket
+ * @param events	The events reported for the socket
+ * @param arg		The connection
+ */
+void on_joining_ready(int fd, uint32_t events, void* arg) {
+	Joining* j = arg;
+	Packet pkt;
+	int status = conn_recv_packet(&j->conn, &pkt);
+	if(status == 0) {
+		return;
+	}
+
+	/* the connection is no longer waited for, whatever it has sent */
+	Acceptor* acc = j->acc;
+	Connection conn = j->conn;
+	event_loop_del(&acc->loop, &j->src);
+	timer_cancel(&acc->timers, &j->timeout);
+	free(j);
+
+	Hello proposed;
+	if(status != 1 || (pkt.type != PKT_HELLO && pkt.type != PKT_REJOIN) ||
+		decode_hello((unsigned char*) pkt.payload, pkt.payload_size, &proposed) < 0) {
+		fprintf(stderr, "Failed to receive HELLO from client, connection rejected\n");
+		close(conn.fd);
+		conn_destroy(&conn);
+		return;
+	}
+	join_channel(acc, &conn, &pkt, &proposed);
+}
+
+/**
+ * Event loop handler of the listening socket, accepts all the pending
+ * connections and waits for their HELLO without blocking, so that a client
+ * that does not send one holds up no other
+ * @param fd		The listening socket
+ * @param events	The events reported for the socket
+ * @param arg		The acceptor
+ */
+void on_listen_ready(int fd, uint32_t events, void* arg) {
+	Acceptor* acc = arg;
+	for(;;) {
+		int sock = accept(fd, NULL, NULL);
+		if(sock < 0) {
+			if(errno == EAGAIN || errno == EWOULDBLOCK) {
+				return;
+			}
+			if(errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			report_error("Failed to accept incoming connection");
+		}
+
+		Joining* j = malloc(sizeof(Joining));
+		if(j == NULL) {
+			perror("Failed to allocate connection buffers");
+			close(sock);
+			continue;
+		}
+		if(conn_init(&j->conn, sock, MAX_HELLO_SIZE) < 0) {
+			perror("Failed to allocate connection buffers");
+			close(sock);
+			conn_destroy(&j->conn);
+			free(j);
+			continue;
+		}
+		j->acc = acc;
+		j->src.fd = sock;
+		j->src.handler = on_joining_ready;
+		j->src.arg = j;
+		timer_init(&j->timeout, on_hello_timeout, j);
+		if(make_nonblocking(sock) < 0 || event_loop_add(&acc->loop, &j->src, EPOLLIN | EPOLLET) < 0) {
+			perror("Failed to watch connection");
+			close(sock);
+			conn_destroy(&j->conn);
+			free(j);
+			continue;
+		}
+		timer_arm(&acc->timers, &j->timeout, (uint64_t) HELLO_TIMEOUT_MS * 1000);
+
+		/* the HELLO may have arrived along with the connection */
+		on_joining_ready(sock, EPOLLIN, j);
+	}
+}
+
+int main(int argc, char* argv[]) {
+	Acceptor acc;
+	memset(&acc, 0, sizeof(Acceptor));
+	pthread_mutex_init(&acc.destinations.lock, NULL);
+	pthread_cond_init(&acc.destinations.released, NULL);
+	acc.out_dir = ".";
+	acc.num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	acc.verbosity = VERBOSITY_PROGRESS;
+	for(int i = 0; i < MAX_CHANNELS; i++) {
+		impair_config_init(&acc.impair[i]);
+		acc.impair[i].loss = PACKET_DROP_RATE / 100.0;
+		acc.impair[i].seed = time(0);
+	}
+
+	int opt;
+	while((opt = getopt(argc, argv, "b:d:t:l:i:upv:T:")) != -1) {
+		switch(opt) {
+			case 'b': {
+				acc.reorder_capacity = atoi(optarg);
+			}
+			break;
+			case 'd': {
+				acc.out_dir = optarg;
+			}
+			break;
+			case 't': {
+				acc.num_workers = atoi(optarg);
+			}
+			break;
+			case 'l': {
+				/* shorthand for uniform loss on every channel */
+				int drop_rate = atoi(optarg);
+				if(drop_rate < 0 || drop_rate > 100) {
+					fprintf(stderr, "Drop rate must be a percentage between 0 and 100\n");
+					exit(1);
+				}
+				for(int i = 0; i < MAX_CHANNELS; i++) {
+					acc.impair[i].loss = drop_rate / 100.0;
+				}
+			}
+			break;
+			case 'i': {
+				if(impair_config_parse(acc.impair, MAX_CHANNELS, optarg) < 0) {
+					fprintf(stderr, "Invalid impairment: %s\n", optarg);
+					exit(1);
+				}
+			}
+			break;
+			case 'u': {
+				acc.use_uring = 1;
+			}
+			break;
+			case 'p': {
+				acc.positional = 1;
+			}
+			break;
+			case 'v': {
+				acc.verbosity = atoi(optarg);
+			}
+			break;
+			case 'T': {
+				acc.trace_path = optarg;
+			}
+			break;
+			default: {
+				fprintf(stderr, "Usage: %s [-b reorder_buffer_packets] [-d output_dir] [-t worker_threads] [-l drop_rate] [-i impairment] [-u] [-p] [-v verbosity] [-T trace_file]\n",
+					argv[0]);
+				exit(1);
+			}
+		}
+	}
+	if(acc.reorder_capacity < 0 || acc.reorder_capacity > MAX_CHANNELS * MAX_WINDOW) {
+		fprintf(stderr, "Reorder buffer size must be between 0 and %d packets\n", MAX_CHANNELS * MAX_WINDOW);
+		exit(1);
+	}
+	if(acc.num_workers < 1 || acc.num_workers > MAX_WORKERS) {
+		fprintf(stderr, "No. of worker threads must be between 1 and %d\n", MAX_WORKERS);
+		exit(1);
+	}
+
+	/* create a socket */
+	acc.listen_sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if(acc.listen_sock < 0) {
+		report_error("Failed to create socket");
+	}
+
+	/* Create address structure */
+	struct sockaddr_in server_addr;
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_port = htons(SERVER_PORT);
+	server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	/* Allow socket descriptor to be usable */
+	int i = 1;
+	if(setsockopt(acc.listen_sock, SOL_SOCKET, SO_REUSEADDR, (char*) &i, sizeof(i)) < 0) {
+		report_error("Failed to make socket reusable");
+	}
+
+	/* binding server socket */
+	if(bind(acc.listen_sock, (struct sockaddr*) &server_addr, sizeof(server_addr)) < 0) {
+		report_error("Failed to bind the socket");
+	}
+
+	if(listen(acc.listen_sock, MAX_PENDING) < 0) {
+		report_error("Failed to setup listening mode of socket");
+	}
+
+	acc.workers = calloc(acc.num_workers, sizeof(Worker));
+	if(acc.workers == NULL) {
+		report_error("Failed to allocate workers");
+	}
+	/* every worker records into a ring of its own, written out by the thread of the tracer */
+	TraceRing* rings[MAX_WORKERS] = { NULL };
+	if(acc.trace_path != NULL) {
+		if(tracer_open(&acc.tracer, acc.trace_path) < 0) {
+			report_error("Failed to open trace file");
+		}
+		for(i = 0; i < acc.num_workers; i++) {
+			if((rings[i] = tracer_add_ring(&acc.tracer)) == NULL) {
+				report_error("Failed to start tracing");
+			}
+		}
+		if(tracer_start(&acc.tracer) < 0) {
+			report_error("Failed to start tracing");
+		}
+	}
+	for(i = 0; i < acc.num_workers; i++) {
+		start_worker(&acc.workers[i], acc.impair, rings[i], &acc.destinations, acc.verbosity);
+	}
+
+	/* the acceptor's own event loop runs on the main thread */
+	if(event_loop_init(&acc.loop) < 0) {
+		report_error("Failed to create event loop");
+	}
+	timer_wheel_init(&acc.timers);
+	acc.listener.fd = acc.listen_sock;
+	acc.listener.handler = on_listen_ready;
+	acc.listener.arg = &acc;
+	if(make_nonblocking(acc.listen_sock) < 0 || event_loop_add(&acc.loop, &acc.listener, EPOLLIN | EPOLLET) < 0) {
+		report_error("Failed to watch listening socket");
+	}
+	timer_init(&acc.expiry_timer, on_expiry_timeout, &acc);
+	timer_arm(&acc.timers, &acc.expiry_timer, (uint64_t) EXPIRY_INTERVAL_MS * 1000);
+	printf("Serving transfers into %s with %d worker threads\n", acc.out_dir, acc.num_workers);
+
+	for(;;) {
+		/* wait for connections and HELLOs until the earliest HELLO timeout or sweep is due */
+		if(event_loop_run_once(&acc.loop, timer_wheel_next_timeout_ms(&acc.timers)) < 0) {
+			report_error("Error occurred in epoll_wait()");
+		}
+		timer_wheel_advance(&acc.timers);
+	}
+	return 0;
+}
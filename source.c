@@ -0,0 +1,496 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "source.h"
+#include "crc32c.h"
+
+/**
+ * Mixes the identity of a file into the ID of the input, which changes
+ * whenever a file is modified, replaced, renamed or resized
+ * @param src	The source
+ * @param st	The status of the file
+ * @param path	The path of the file within the tree, NULL for a single file
+ */
+static void identify(Source* src, const struct stat* st, const char* path) {
+	uint64_t fields[] = { st->st_dev, st->st_ino, st->st_size, st->st_mtim.tv_sec, st->st_mtim.tv_nsec };
+	const unsigned char* bytes = (const unsigned char*) fields;
+	uint64_t hash = (src->file_id != 0) ? src->file_id : FNV_OFFSET_BASIS;
+
+	/* FNV-1a over the fields and the path */
+	for(size_t i = 0; i < sizeof(fields); i++) {
+		hash = (hash ^ bytes[i]) * FNV_PRIME;
+	}
+	for(; path != NULL && *path != '\0'; path++) {
+		hash = (hash ^ (unsigned char) *path) * FNV_PRIME;
+	}
+	src->file_id = (hash != 0) ? hash : 1;
+}
+
+/**
+ * Appends a segment to the stream
+ * @param src		The source
+ * @param data		The contents of the segment
+ * @param size		The size of the segment
+ * @param is_mapped	1 if the contents are a mapped file, 0 if a batch on the heap
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int add_segment(Source* src, char* data, uint64_t size, int is_mapped) {
+	/* grow to the next power of two */
+	if((src->num_segments & (src->num_segments - 1)) == 0) {
+		int capacity = (src->num_segments > 0) ? 2 * src->num_segments : 1;
+		Segment* segments = realloc(src->segments, capacity * sizeof(Segment));
+		if(segments == NULL) {
+			return -1;
+		}
+		src->segments = segments;
+	}
+	Segment* seg = &src->segments[src->num_segments++];
+	seg->data = data;
+	seg->start = src->size;
+	seg->size = size;
+	seg->is_mapped = is_mapped;
+	src->size += size;
+	return 0;
+}
+
+/**
+ * Maps a file into memory, so that packets can be sent straight from the page
+ * cache without copying their payload
+ * @param src	The source
+ * @param path	The path of the file
+ * @param size	The size of the file, -1 if not known yet
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int map_segment(Source* src, const char* path, int64_t size) {
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		return -1;
+	}
+	struct stat st;
+	if(fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	if(size < 0) {
+		identify(src, &st, NULL);
+	} else if(st.st_size != size) {
+		/* changed since it was listed in the manifest */
+		close(fd);
+		errno = EIO;
+		return -1;
+	}
+	if(st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) {
+		return -1;
+	}
+	/* the file is read front to back, let the kernel read ahead aggressively */
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+	if(add_segment(src, data, st.st_size, 1) < 0) {
+		munmap(data, st.st_size);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Reads a whole file into a buffer
+ * @param path	The path of the file
+ * @param buf	The buffer
+ * @param size	The size of the file
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int read_file(const char* path, char* buf, uint64_t size) {
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		return -1;
+	}
+	while(size > 0) {
+		ssize_t n = read(fd, buf, size);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			if(n == 0) {
+				/* truncated since it was listed in the manifest */
+				errno = EIO;
+			}
+			close(fd);
+			return -1;
+		}
+		buf += n;
+		size -= n;
+	}
+	close(fd);
+	return 0;
+}
+
+/**
+ * Adds a file to the manifest of a tree
+ * @param src	The source
+ * @param local	The path of the file on this host
+ * @param path	The path of the file within the tree
+ * @param st	The status of the file
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int add_entry(Source* src, const char* local, const char* path, const struct stat* st) {
+	if(strlen(path) > MAX_PATH_LEN) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if((src->num_entries & (src->num_entries - 1)) == 0) {
+		int capacity = (src->num_entries > 0) ? 2 * src->num_entries : 1;
+		ManifestEntry* entries = realloc(src->entries, capacity * sizeof(ManifestEntry));
+		if(entries == NULL) {
+			return -1;
+		}
+		src->entries = entries;
+		char** local_paths = realloc(src->local_paths, capacity * sizeof(char*));
+		if(local_paths == NULL) {
+			return -1;
+		}
+		src->local_paths = local_paths;
+	}
+	char* path_copy = strdup(path);
+	char* local_copy = strdup(local);
+	if(path_copy == NULL || local_copy == NULL) {
+		free(path_copy);
+		free(local_copy);
+		return -1;
+	}
+	identify(src, st, path);
+	ManifestEntry* e = &src->entries[src->num_entries];
+	e->path = path_copy;
+	e->size = st->st_size;
+	e->mode = st->st_mode & 0777;
+	src->local_paths[src->num_entries] = local_copy;
+	src->num_entries++;
+	return 0;
+}
+
+/**
+ * Adds the regular files below a directory to the manifest, in sorted order.
+ * Symbolic links and special files are skipped.
+ * @param src	The source
+ * @param local	The path of the directory on this host
+ * @param path	The path of the directory within the tree, NULL for its root
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int walk_dir(Source* src, const char* local, const char* path) {
+	struct dirent** names;
+	int num_names = scandir(local, &names, NULL, alphasort);
+	if(num_names < 0) {
+		return -1;
+	}
+
+	int status = 0;
+	for(int i = 0; i < num_names; i++) {
+		const char* name = names[i]->d_name;
+		if(status < 0 || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+			free(names[i]);
+			continue;
+		}
+		char child_local[PATH_MAX];
+		char child_path[PATH_MAX];
+		struct stat st;
+		if(snprintf(child_local, sizeof(child_local), "%s/%s", local, name) >= (int) sizeof(child_local) ||
+			snprintf(child_path, sizeof(child_path), "%s%s%s", path != NULL ? path : "", path != NULL ? "/" : "",
+			name) >= (int) sizeof(child_path)) {
+			errno = ENAMETOOLONG;
+			status = -1;
+		} else if(lstat(child_local, &st) < 0) {
+			status = -1;
+		} else if(S_ISDIR(st.st_mode)) {
+			status = walk_dir(src, child_local, child_path);
+		} else if(S_ISREG(st.st_mode)) {
+			status = add_entry(src, child_local, child_path, &st);
+		}
+		free(names[i]);
+	}
+	free(names);
+	return status;
+}
+
+/**
+ * Finds the name under which a path given on the command line appears in a tree
+ * @param path	The path
+ * @param name	Output, the last component of the path
+ * @param size	The size of the output
+ *
+ * @return 0 on success, -1 if the path has no usable name (e.g. "/" or "..")
+ */
+static int base_name(const char* path, char* name, size_t size) {
+	size_t len = strlen(path);
+	while(len > 1 && path[len - 1] == '/') {
+		len--;
+	}
+	size_t start = len;
+	while(start > 0 && path[start - 1] != '/') {
+		start--;
+	}
+	len -= start;
+	if(len == 0 || len >= size || (len == 1 && path[start] == '.') ||
+		(len == 2 && path[start] == '.' && path[start + 1] == '.')) {
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(name, path + start, len);
+	name[len] = '\0';
+	return 0;
+}
+
+/**
+ * Lays out the stream of a tree once its manifest is complete: the manifest
+ * and the small files are read into batches, the large files are mapped
+ * @param src	The source
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int build_stream(Source* src) {
+	size_t size = manifest_size(src->entries, src->num_entries);
+	if(size > MAX_MANIFEST_SIZE) {
+		errno = EFBIG;
+		return -1;
+	}
+	src->manifest_size = size;
+
+	char* batch = malloc(size > BATCH_SIZE ? size : BATCH_SIZE);
+	uint64_t batch_len = size;
+	uint64_t batch_cap = size > BATCH_SIZE ? size : BATCH_SIZE;
+	if(batch == NULL) {
+		return -1;
+	}
+	encode_manifest(src->entries, src->num_entries, (unsigned char*) batch);
+
+	for(int i = 0; i < src->num_entries; i++) {
+		uint64_t file_size = src->entries[i].size;
+		if(file_size >= SMALL_FILE_SIZE) {
+			/* large files end the batch and are sent from the page cache */
+			if(batch_len == 0) {
+				free(batch);
+			} else if(add_segment(src, batch, batch_len, 0) < 0) {
+				free(batch);
+				return -1;
+			}
+			batch = NULL;
+			batch_len = batch_cap = 0;
+			if(map_segment(src, src->local_paths[i], file_size) < 0) {
+				return -1;
+			}
+			continue;
+		}
+
+		if(batch != NULL && batch_cap - batch_len < file_size) {
+			/* the batch is full */
+			if(add_segment(src, batch, batch_len, 0) < 0) {
+				free(batch);
+				return -1;
+			}
+			batch = NULL;
+			batch_len = batch_cap = 0;
+		}
+		if(batch == NULL) {
+			batch_cap = BATCH_SIZE;
+			batch = malloc(batch_cap);
+			if(batch == NULL) {
+				return -1;
+			}
+		}
+		if(read_file(src->local_paths[i], batch + batch_len, file_size) < 0) {
+			free(batch);
+			return -1;
+		}
+		batch_len += file_size;
+	}
+	if(batch_len > 0) {
+		if(add_segment(src, batch, batch_len, 0) < 0) {
+			free(batch);
+			return -1;
+		}
+	} else {
+		free(batch);
+	}
+	return 0;
+}
+
+/**
+ * Opens a single file as the stream
+ * @param src	The source
+ * @param path	The path of the file
+ *
+ * @return 0 on success, -1 on failure
+ */
+int source_open_file(Source* src, const char* path) {
+	memset(src, 0, sizeof(Source));
+	return map_segment(src, path, -1);
+}
+
+/**
+ * Opens a tree of files as the stream. The files of a single directory are
+ * listed relative to it, otherwise every path is listed under its last
+ * component.
+ * @param src		The source
+ * @param paths		The files and directories to be sent
+ * @param num_paths	The no. of paths
+ *
+ * @return 0 on success, -1 on failure
+ */
+int source_open_tree(Source* src, char* const* paths, int num_paths) {
+	memset(src, 0, sizeof(Source));
+	src->is_tree = 1;
+	for(int i = 0; i < num_paths; i++) {
+		char name[NAME_MAX + 1];
+		struct stat st;
+		if(base_name(paths[i], name, sizeof(name)) < 0 || stat(paths[i], &st) < 0) {
+			return -1;
+		}
+		if(S_ISDIR(st.st_mode)) {
+			if(walk_dir(src, paths[i], num_paths == 1 ? NULL : name) < 0) {
+				return -1;
+			}
+		} else if(S_ISREG(st.st_mode)) {
+			if(add_entry(src, paths[i], name, &st) < 0) {
+				return -1;
+			}
+		} else {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	return build_stream(src);
+}
+
+/**
+ * Gets a contiguous part of the stream, for the payload of a packet. Reads
+ * are expected to move forward through the stream.
+ * @param src		The source
+ * @param offset	The offset of the part in the stream
+ * @param len		The length of the part
+ * @param bounce	A buffer of at least len bytes that receives a copy of a
+ * 					part spanning several segments, or NULL
+ *
+ * @return The part, NULL if it spans segments and there is no buffer
+ */
+const char* source_read(Source* src, uint64_t offset, uint32_t len, char* bounce) {
+	if(len == 0) {
+		return "";
+	}
+	if(src->cursor >= src->num_segments || offset < src->segments[src->cursor].start) {
+		src->cursor = 0;
+	}
+	while(offset >= src->segments[src->cursor].start + src->segments[src->cursor].size) {
+		src->cursor++;
+	}
+	Segment* seg = &src->segments[src->cursor];
+	if(offset + len <= seg->start + seg->size) {
+		return seg->data + (offset - seg->start);
+	}
+
+	/* the part spans segments, copy it */
+	if(bounce == NULL) {
+		return NULL;
+	}
+	uint32_t copied = 0;
+	for(int i = src->cursor; copied < len; i++) {
+		seg = &src->segments[i];
+		uint64_t from = offset + copied - seg->start;
+		uint64_t n = seg->size - from;
+		if(n > len - copied) {
+			n = len - copied;
+		}
+		memcpy(bounce + copied, seg->data + from, n);
+		copied += n;
+	}
+	return bounce;
+}
+
+/**
+ * Computes the CRC32C of a part of the stream. Unlike source_read(), it
+ * keeps its position in a cursor of the caller, so that a thread of its own
+ * can read ahead.
+ * @param src		The source
+ * @param offset	The offset of the part in the stream
+ * @param len		The length of the part
+ * @param cursor	The segment of the latest part read with it, 0 at first
+ *
+ * @return The CRC32C
+ */
+uint32_t source_checksum(Source* src, uint64_t offset, uint32_t len, int* cursor) {
+	if(*cursor >= src->num_segments || offset < src->segments[*cursor].start) {
+		*cursor = 0;
+	}
+	uint32_t crc = 0;
+	while(len > 0) {
+		Segment* seg = &src->segments[*cursor];
+		if(offset >= seg->start + seg->size) {
+			(*cursor)++;
+			continue;
+		}
+		uint64_t n = seg->start + seg->size - offset;
+		if(n > len) {
+			n = len;
+		}
+		crc = crc32c(crc, seg->data + (offset - seg->start), n);
+		offset += n;
+		len -= n;
+	}
+	return crc;
+}
+
+/**
+ * Computes the CRC32C of the start of the stream
+ * @param src	The source
+ * @param len	The no. of bytes, at most the size of the stream
+ *
+ * @return The CRC32C
+ */
+uint32_t source_digest(Source* src, uint64_t len) {
+	uint32_t crc = 0;
+	for(int i = 0; i < src->num_segments && src->segments[i].start < len; i++) {
+		Segment* seg = &src->segments[i];
+		uint64_t n = (len - seg->start < seg->size) ? len - seg->start : seg->size;
+		crc = crc32c(crc, seg->data, n);
+	}
+	return crc;
+}
+
+/**
+ * Unmaps the files and releases the memory of the stream
+ * @param src	The source
+ */
+void source_close(Source* src) {
+	for(int i = 0; i < src->num_segments; i++) {
+		if(src->segments[i].is_mapped) {
+			munmap(src->segments[i].data, src->segments[i].size);
+		} else {
+			free(src->segments[i].data);
+		}
+	}
+	free(src->segments);
+	for(int i = 0; i < src->num_entries; i++) {
+		free(src->local_paths[i]);
+	}
+	free(src->local_paths);
+	if(src->entries != NULL) {
+		free_manifest(src->entries, src->num_entries);
+	}
+	memset(src, 0, sizeof(Source));
+}
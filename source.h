@@ -0,0 +1,50 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "protocol.h"
+
+#define SMALL_FILE_SIZE (64 * 1024) /* files below this size are read into batches instead of being mapped */
+#define BATCH_SIZE (4 * 1024 * 1024) /* a batch is closed once it holds this many bytes */
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/* A contiguous part of the stream held in memory */
+typedef struct segment {
+	char* data;
+	uint64_t start; /* offset in the stream */
+	uint64_t size;
+	int is_mapped; /* a mapped file, otherwise a batch on the heap */
+} Segment;
+
+/*
+ * The stream sent by the client. A single file is mapped as it is. A tree is
+ * sent as its manifest followed by the contents of its files, in the order of
+ * the manifest. Small files are read back to back into batches, together with
+ * the manifest, so that a packet carries many of them. Large files are mapped
+ * and striped over the channels like a single file.
+ */
+typedef struct source {
+	Segment* segments; /* in the order of the stream */
+	int num_segments;
+	int cursor; /* segment of the latest read, reads move forward */
+	uint64_t size; /* bytes of the stream */
+	uint64_t file_id; /* identifies this version of the input, never 0 */
+
+	int is_tree;
+	uint64_t manifest_size;
+	ManifestEntry* entries; /* files of the tree */
+	char** local_paths; /* path of every entry on this host */
+	int num_entries;
+} Source;
+
+int source_open_file(Source* src, const char* path);
+int source_open_tree(Source* src, char* const* paths, int num_paths);
+const char* source_read(Source* src, uint64_t offset, uint32_t len, char* bounce);
+uint32_t source_checksum(Source* src, uint64_t offset, uint32_t len, int* cursor);
+uint32_t source_digest(Source* src, uint64_t len);
+void source_close(Source* src);
+
+#endif
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../reorder.h"
+
+#define PACKET_SIZE 100
+
+static int failures = 0;
+
+/**
+ * Records a failed check
+ * @param is_ok	The outcome of the check
+ * @param what	The check
+ */
+static void check(int is_ok, const char* what) {
+	if(!is_ok) {
+		fprintf(stderr, "FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+/**
+ * Checks whether a range is among the reported ones
+ * @param blocks		The reported ranges
+ * @param num_blocks	The no. of ranges
+ * @param start			The start of the range
+ * @param end			The end of the range
+ *
+ * @return 1 if it is, 0 otherwise
+ */
+static int is_reported(SackBlock* blocks, int num_blocks, uint64_t start, uint64_t end) {
+	for(int i = 0; i < num_blocks; i++) {
+		if(blocks[i].start == start && blocks[i].end == end) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Holds the packet of a packet no.
+ * @param rb	The reorder buffer
+ * @param no	The packet no.
+ */
+static void hold(ReorderBuffer* rb, int no) {
+	check(reorder_insert(rb, (uint64_t) no * PACKET_SIZE, NULL, PACKET_SIZE, 0) == 1, "packet is held");
+}
+
+/* the newest range comes first even with more gaps than blocks */
+static void test_newest_first(void) {
+	ReorderBuffer rb;
+	SackBlock blocks[MAX_SACK_BLOCKS];
+	check(reorder_init(&rb, 0, 0, 64, PACKET_SIZE, 0) == 0, "buffer is allocated");
+
+	/* six ranges of one packet each, above six gaps */
+	for(int no = 2; no <= 12; no += 2) {
+		hold(&rb, no);
+	}
+	int num_blocks = reorder_sack(&rb, blocks, MAX_SACK_BLOCKS);
+	check(num_blocks == MAX_SACK_BLOCKS, "all blocks are used");
+	check(blocks[0].start == 1200 && blocks[0].end == 1300, "the newest range comes first");
+	check(is_reported(blocks, num_blocks, 1000, 1100), "the range received before it is reported");
+	check(!is_reported(blocks, num_blocks, 200, 300), "the oldest range is left out");
+
+	/* a packet extending a range reports the whole range first */
+	hold(&rb, 13);
+	num_blocks = reorder_sack(&rb, blocks, MAX_SACK_BLOCKS);
+	check(blocks[0].start == 1200 && blocks[0].end == 1400, "the extended range comes first");
+	for(int i = 1; i < num_blocks; i++) {
+		check(blocks[i].start != 1200, "a range is reported once");
+	}
+
+	/* a packet filling a gap low down is reported at once */
+	hold(&rb, 3);
+	num_blocks = reorder_sack(&rb, blocks, MAX_SACK_BLOCKS);
+	check(blocks[0].start == 200 && blocks[0].end == 500, "the newest range comes first, however low");
+	reorder_destroy(&rb);
+}
+
+/* ranges of packets flushed are forgotten, the rest is filled from the lowest ranges */
+static void test_flushed(void) {
+	ReorderBuffer rb;
+	SackBlock blocks[MAX_SACK_BLOCKS];
+	check(reorder_init(&rb, 0, 0, 64, PACKET_SIZE, 0) == 0, "buffer is allocated");
+	hold(&rb, 5);
+	hold(&rb, 1);
+	hold(&rb, 3);
+
+	/* the expected packet arrives, packet 1 continues it */
+	reorder_skip(&rb, PACKET_SIZE, 0);
+	check(reorder_flush(&rb, NULL) == 0, "held packets are released");
+	check(rb.next_seq == 200, "the stream continues with the held packet");
+	int num_blocks = reorder_sack(&rb, blocks, MAX_SACK_BLOCKS);
+	check(num_blocks == 2, "the flushed range is not reported");
+	check(blocks[0].start == 300 && blocks[0].end == 400, "the newest range comes first");
+	check(is_reported(blocks, num_blocks, 500, 600), "the older range is reported");
+	reorder_destroy(&rb);
+}
+
+int main(void) {
+	test_newest_first();
+	test_flushed();
+	if(failures > 0) {
+		return 1;
+	}
+	printf("reorder_test: all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,189 @@
+#include <time.h>
+#include <stddef.h>
+
+#include "timer.h"
+
+/**
+ * Reads the monotonic clock, which is unaffected by changes to the wall clock
+ * and keeps running while the process is blocked
+ * 
+ * @return The current monotonic time in micro-seconds
+ */
+uint64_t monotonic_usec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Converts the current monotonic time to a tick of a wheel
+ * @param wheel	The timer wheel
+ * 
+ * @return The current tick
+ */
+static uint64_t current_tick(TimerWheel* wheel) {
+	return (monotonic_usec() - wheel->start_usec) / TIMER_TICK_USEC;
+}
+
+/**
+ * Unlinks a timer from the list it is part of
+ * @param timer	The timer
+ */
+static void unlink_timer(Timer* timer) {
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = timer->prev = NULL;
+}
+
+/**
+ * Appends a timer to a list
+ * @param head	The list head
+ * @param timer	The timer
+ */
+static void link_timer(Timer* head, Timer* timer) {
+	timer->prev = head->prev;
+	timer->next = head;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+
+/**
+ * Initializes an empty timer wheel starting at the current time
+ * @param wheel	The timer wheel
+ */
+void timer_wheel_init(TimerWheel* wheel) {
+	for(int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+		wheel->slots[i].next = wheel->slots[i].prev = &wheel->slots[i];
+	}
+	wheel->start_usec = monotonic_usec();
+	wheel->current_tick = 0;
+	wheel->num_armed = 0;
+}
+
+/**
+ * Initializes a disarmed timer
+ * @param timer		The timer
+ * @param handler	Callback invoked on expiry
+ * @param arg		Argument passed to the callback
+ */
+void timer_init(Timer* timer, timer_handler handler, void* arg) {
+	timer->next = timer->prev = NULL;
+	timer->expires = 0;
+	timer->is_armed = 0;
+	timer->handler = handler;
+	timer->arg = arg;
+}
+
+/**
+ * Arms a timer to expire after the given time, re-arming it if it was
+ * already armed. Runs in constant time.
+ * @param wheel			The timer wheel
+ * @param timer			The timer
+ * @param timeout_usec	Time after which the timer expires, in micro-seconds
+ */
+void timer_arm(TimerWheel* wheel, Timer* timer, uint64_t timeout_usec) {
+	timer_cancel(wheel, timer);
+
+	/* round up, a timer must never fire early */
+	uint64_t expires = (monotonic_usec() - wheel->start_usec + timeout_usec + TIMER_TICK_USEC - 1) / TIMER_TICK_USEC;
+	if(expires <= wheel->current_tick) {
+		expires = wheel->current_tick + 1;
+	}
+	timer->expires = expires;
+	link_timer(&wheel->slots[expires & (TIMER_WHEEL_SLOTS - 1)], timer);
+	timer->is_armed = 1;
+	wheel->num_armed++;
+}
+
+/**
+ * Disarms a timer, if armed. Runs in constant time.
+ * @param wheel	The timer wheel
+ * @param timer	The timer
+ */
+void timer_cancel(TimerWheel* wheel, Timer* timer) {
+	if(timer->is_armed) {
+		unlink_timer(timer);
+		timer->is_armed = 0;
+		wheel->num_armed--;
+	}
+}
+
+/**
+ * Computes how long an event loop may wait before the next timer expires
+ * @param wheel	The timer wheel
+ * 
+ * @return The time in milliseconds until the earliest timer expires, or -1
+ * 		   if no timer is armed
+ */
+int timer_wheel_next_timeout_ms(TimerWheel* wheel) {
+	if(wheel->num_armed == 0) {
+		return -1;
+	}
+
+	/* find the earliest tick within one revolution that has a timer due */
+	uint64_t next_tick = wheel->current_tick + TIMER_WHEEL_SLOTS;
+	for(uint64_t tick = wheel->current_tick + 1; tick <= wheel->current_tick + TIMER_WHEEL_SLOTS; tick++) {
+		Timer* head = &wheel->slots[tick & (TIMER_WHEEL_SLOTS - 1)];
+		int is_due = 0;
+		for(Timer* t = head->next; t != head; t = t->next) {
+			if(t->expires <= tick) {
+				is_due = 1;
+				break;
+			}
+		}
+		if(is_due) {
+			next_tick = tick;
+			break;
+		}
+	}
+
+	uint64_t now_usec = monotonic_usec() - wheel->start_usec;
+	uint64_t next_usec = next_tick * TIMER_TICK_USEC;
+	if(next_usec <= now_usec) {
+		return 0;
+	}
+	return (int) ((next_usec - now_usec + 999) / 1000);
+}
+
+/**
+ * Fires every timer that has expired by the current time
+ * @param wheel	The timer wheel
+ */
+void timer_wheel_advance(TimerWheel* wheel) {
+	uint64_t now_tick = current_tick(wheel);
+	if(now_tick <= wheel->current_tick) {
+		return;
+	}
+
+	/* collect the expired timers first, handlers may arm and cancel timers */
+	Timer expired;
+	expired.next = expired.prev = &expired;
+
+	/* a gap larger than a revolution visits every slot only once */
+	uint64_t last_tick = now_tick;
+	if(now_tick - wheel->current_tick > TIMER_WHEEL_SLOTS) {
+		last_tick = wheel->current_tick + TIMER_WHEEL_SLOTS;
+	}
+	for(uint64_t tick = wheel->current_tick + 1; tick <= last_tick; tick++) {
+		Timer* head = &wheel->slots[tick & (TIMER_WHEEL_SLOTS - 1)];
+		Timer* t = head->next;
+		while(t != head) {
+			Timer* next = t->next;
+			if(t->expires <= now_tick) {
+				unlink_timer(t);
+				link_timer(&expired, t);
+			}
+			t = next;
+		}
+	}
+	wheel->current_tick = now_tick;
+
+	/* expired timers stay armed until fired, so that cancelling them still works */
+	while(expired.next != &expired) {
+		Timer* t = expired.next;
+		unlink_timer(t);
+		t->is_armed = 0;
+		wheel->num_armed--;
+		t->handler(t, t->arg);
+	}
+}
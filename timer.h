@@ -0,0 +1,49 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+#define TIMER_WHEEL_SLOTS 1024 /* must be a power of two */
+#define TIMER_TICK_USEC 1000 /* resolution of the timer wheel */
+
+struct timer;
+
+/**
+ * Callback invoked when a timer expires. The timer is disarmed before the
+ * callback runs, so it may be re-armed from within.
+ * @param timer	The expired timer
+ * @param arg	The argument registered along with the timer
+ */
+typedef void (*timer_handler)(struct timer* timer, void* arg);
+
+/* A one-shot timer, embedded by its owner and linked into a wheel slot when armed */
+typedef struct timer {
+	struct timer* next;
+	struct timer* prev;
+	uint64_t expires; /* tick at which the timer fires */
+	int is_armed;
+	timer_handler handler;
+	void* arg;
+} Timer;
+
+/*
+ * Hashed timer wheel: a timer is kept in the slot of its expiry tick, timers
+ * more than one revolution away stay in their slot until their tick comes.
+ */
+typedef struct timer_wheel {
+	Timer slots[TIMER_WHEEL_SLOTS]; /* list heads of each slot */
+	uint64_t start_usec; /* monotonic time of tick 0 */
+	uint64_t current_tick; /* last tick whose timers have been fired */
+	int num_armed;
+} TimerWheel;
+
+uint64_t monotonic_usec(void);
+
+void timer_wheel_init(TimerWheel* wheel);
+void timer_init(Timer* timer, timer_handler handler, void* arg);
+void timer_arm(TimerWheel* wheel, Timer* timer, uint64_t timeout_usec);
+void timer_cancel(TimerWheel* wheel, Timer* timer);
+int timer_wheel_next_timeout_ms(TimerWheel* wheel);
+void timer_wheel_advance(TimerWheel* wheel);
+
+#endif
@@ -0,0 +1,214 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "trace.h"
+#include "timer.h"
+
+static const char* const event_names[] = { "send", "retransmit", "receive", "ack_sent", "ack_received", "drop",
+	"reorder", "duplicate", "corrupt" };
+
+/**
+ * Opens a trace file, JSON lines if its name ends with .json or .jsonl,
+ * binary otherwise
+ * @param t		The tracer
+ * @param path	The path of the trace file
+ *
+ * @return 0 on success, -1 on failure
+ */
+int tracer_open(Tracer* t, const char* path) {
+	memset(t, 0, sizeof(Tracer));
+	size_t len = strlen(path);
+	t->is_json = (len >= 5 && strcmp(path + len - 5, ".json") == 0) ||
+		(len >= 6 && strcmp(path + len - 6, ".jsonl") == 0);
+	t->file = fopen(path, "w");
+	if(t->file == NULL) {
+		return -1;
+	}
+	if(!t->is_json && fwrite(TRACE_MAGIC, strlen(TRACE_MAGIC), 1, t->file) != 1) {
+		fclose(t->file);
+		t->file = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Adds a ring for a thread recording events, before the tracer is started
+ * @param t	The tracer
+ *
+ * @return The ring, or NULL on failure
+ */
+TraceRing* tracer_add_ring(Tracer* t) {
+	TraceRing* ring = aligned_alloc(64, sizeof(TraceRing));
+	if(ring == NULL) {
+		return NULL;
+	}
+	memset(ring, 0, sizeof(TraceRing));
+	ring->events = malloc(TRACE_RING_SIZE * sizeof(TraceEvent));
+	if(ring->events == NULL) {
+		free(ring);
+		return NULL;
+	}
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	atomic_init(&ring->lost, 0);
+	ring->next = t->rings;
+	t->rings = ring;
+	return ring;
+}
+
+/**
+ * Records an event. Does nothing without a ring, i.e. when tracing is off.
+ * @param ring			The ring of the calling thread, or NULL
+ * @param type			The type of the event, TRACE_SEND, ...
+ * @param session_id	The transfer
+ * @param channel_no	The channel
+ * @param seq_no		The sequence no. of the packet
+ * @param size			The payload bytes of the packet, or the SACK blocks
+ * 						of an ACK
+ * @param is_last		1 for the last packet of the stream
+ */
+void trace_record(TraceRing* ring, int type, uint64_t session_id, int channel_no, uint64_t seq_no, uint32_t size,
+	int is_last) {
+	if(ring == NULL) {
+		return;
+	}
+	uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if(head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= TRACE_RING_SIZE) {
+		atomic_fetch_add_explicit(&ring->lost, 1, memory_order_relaxed);
+		return;
+	}
+	TraceEvent* e = &ring->events[head & (TRACE_RING_SIZE - 1)];
+	e->usec = monotonic_usec();
+	e->session_id = session_id;
+	e->seq_no = seq_no;
+	e->size = size;
+	e->channel_no = channel_no;
+	e->type = type;
+	e->is_last = is_last;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * Writes out the events recorded in the rings so far
+ * @param t	The tracer
+ *
+ * @return The no. of events written
+ */
+static unsigned long drain(Tracer* t) {
+	unsigned long n = 0;
+	for(TraceRing* ring = t->rings; ring != NULL; ring = ring->next) {
+		uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		for(; tail < head; tail++) {
+			TraceEvent* e = &ring->events[tail & (TRACE_RING_SIZE - 1)];
+			if(!t->is_json) {
+				fwrite(e, sizeof(TraceEvent), 1, t->file);
+			} else {
+				fprintf(t->file, "{\"usec\": %" PRIu64 ", \"event\": \"%s\", \"session\": \"%016" PRIx64 "\", "
+					"\"channel\": %d, \"seq\": %" PRIu64 ", \"size\": %" PRIu32 ", \"last\": %d}\n", e->usec,
+					event_names[e->type], e->session_id, e->channel_no, e->seq_no, e->size, e->is_last);
+			}
+			n++;
+		}
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+	}
+	t->written += n;
+	return n;
+}
+
+/**
+ * Body of the drain thread, writes out the events until the tracer is closed
+ * @param arg	The tracer
+ */
+static void* drain_thread(void* arg) {
+	Tracer* t = arg;
+	struct timespec pause = { 0, TRACE_DRAIN_INTERVAL_MS * 1000000L };
+	while(atomic_load(&t->is_running)) {
+		if(drain(t) == 0) {
+			nanosleep(&pause, NULL);
+		} else {
+			/* a server is usually stopped by a signal, keep the file complete up to here */
+			fflush(t->file);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Starts the drain thread, once all the rings have been added
+ * @param t	The tracer
+ *
+ * @return 0 on success, -1 on failure
+ */
+int tracer_start(Tracer* t) {
+	atomic_store(&t->is_running, 1);
+	int status = pthread_create(&t->thread, NULL, drain_thread, t);
+	if(status != 0) {
+		atomic_store(&t->is_running, 0);
+		errno = status;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Stops the drain thread, writes out the remaining events and closes the
+ * trace file. The producers must have stopped recording.
+ * @param t	The tracer
+ */
+void tracer_close(Tracer* t) {
+	if(t->file == NULL) {
+		return;
+	}
+	if(atomic_load(&t->is_running)) {
+		atomic_store(&t->is_running, 0);
+		pthread_join(t->thread, NULL);
+	}
+	drain(t);
+	unsigned long lost = 0;
+	while(t->rings != NULL) {
+		TraceRing* ring = t->rings;
+		t->rings = ring->next;
+		lost += atomic_load(&ring->lost);
+		free(ring->events);
+		free(ring);
+	}
+	if(lost > 0) {
+		fprintf(stderr, "Trace: %lu events lost to full rings\n", lost);
+	}
+	fclose(t->file);
+	t->file = NULL;
+}
+
+/**
+ * Counts a value in a histogram
+ * @param h		The histogram
+ * @param value	The value
+ */
+void histogram_add(Histogram* h, uint64_t value) {
+	int bucket = 0;
+	while(bucket < HISTOGRAM_BUCKETS - 1 && value >= ((uint64_t) 1 << bucket)) {
+		bucket++;
+	}
+	h->buckets[bucket]++;
+	h->count++;
+}
+
+/**
+ * Prints the non-empty buckets of a histogram on a line
+ * @param h		The histogram
+ * @param title	Printed before the buckets
+ */
+void histogram_print(Histogram* h, const char* title) {
+	printf("%s", title);
+	for(int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		if(h->buckets[i] > 0) {
+			printf("  <%" PRIu64 ": %lu", (uint64_t) 1 << i, h->buckets[i]);
+		}
+	}
+	printf("\n");
+}
@@ -0,0 +1,85 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define TRACE_RING_SIZE 65536 /* events buffered per ring, a power of two */
+#define TRACE_DRAIN_INTERVAL_MS 10 /* pause of the drain thread once the rings are empty */
+#define TRACE_MAGIC "TCPTRC1\n" /* start of a binary trace file */
+#define STATS_INTERVAL_MS 1000 /* period of the progress counters */
+#define HISTOGRAM_BUCKETS 32
+
+/* verbosity of the console output */
+#define VERBOSITY_QUIET 0 /* summaries and errors only */
+#define VERBOSITY_PROGRESS 1 /* periodic counters as well */
+#define VERBOSITY_PACKETS 2 /* a line per packet as well */
+
+/* types of trace events */
+#define TRACE_SEND 0 /* data packet sent */
+#define TRACE_RETRANSMIT 1 /* data packet sent again */
+#define TRACE_RECEIVE 2 /* data packet received */
+#define TRACE_ACK_SENT 3
+#define TRACE_ACK_RECEIVED 4
+#define TRACE_DROP 5 /* packet lost on the simulated link */
+#define TRACE_REORDER 6 /* data packet held until the packets before it arrive */
+#define TRACE_DUPLICATE 7 /* data packet received again */
+#define TRACE_CORRUPT 8 /* data packet whose payload does not match its checksum */
+
+/*
+ * A trace event as buffered and written to a binary trace file, 32 bytes in
+ * host byte order after the TRACE_MAGIC header
+ */
+typedef struct trace_event {
+	uint64_t usec; /* monotonic time */
+	uint64_t session_id;
+	uint64_t seq_no;
+	uint32_t size; /* payload bytes, or SACK blocks of an ACK */
+	uint16_t channel_no;
+	uint8_t type;
+	uint8_t is_last;
+} TraceEvent;
+
+/*
+ * Single-producer single-consumer ring of trace events. The thread that owns
+ * the ring records events without locks or system calls, the drain thread
+ * writes them out. Events recorded while the ring is full are counted and
+ * lost, recording never waits.
+ */
+typedef struct trace_ring {
+	_Alignas(64) atomic_uint_fast64_t head; /* next event to be recorded, written by the producer */
+	_Alignas(64) atomic_uint_fast64_t tail; /* next event to be written out, written by the drain thread */
+	_Alignas(64) atomic_ulong lost;
+	TraceEvent* events;
+	struct trace_ring* next;
+} TraceRing;
+
+/* Writes the events of the rings of a program to a trace file from its own thread */
+typedef struct tracer {
+	FILE* file;
+	int is_json; /* JSON lines, otherwise binary */
+	TraceRing* rings;
+	pthread_t thread;
+	atomic_int is_running;
+	unsigned long written; /* events written out */
+} Tracer;
+
+/* Counts of values by their power of two */
+typedef struct histogram {
+	unsigned long buckets[HISTOGRAM_BUCKETS]; /* bucket i counts values below 2^i, from 2^(i-1) */
+	unsigned long count;
+} Histogram;
+
+int tracer_open(Tracer* t, const char* path);
+TraceRing* tracer_add_ring(Tracer* t);
+int tracer_start(Tracer* t);
+void tracer_close(Tracer* t);
+void trace_record(TraceRing* ring, int type, uint64_t session_id, int channel_no, uint64_t seq_no, uint32_t size,
+	int is_last);
+
+void histogram_add(Histogram* h, uint64_t value);
+void histogram_print(Histogram* h, const char* title);
+
+#endif
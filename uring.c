@@ -0,0 +1,169 @@
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+/**
+ * Creates an io_uring instance and maps its rings
+ * @param ring		The ring
+ * @param entries	Size of the submission queue, a power of two
+ *
+ * @return 0 on success, -1 on failure (e.g. ENOSYS if the kernel has no
+ * 		   io_uring, EPERM if it is disabled)
+ */
+int uring_init(Uring* ring, unsigned entries) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	memset(ring, 0, sizeof(Uring));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if(ring->fd < 0) {
+		return -1;
+	}
+
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP) {
+		/* both rings share one mapping */
+		if(ring->cq_ring_size > ring->sq_ring_size) {
+			ring->sq_ring_size = ring->cq_ring_size;
+		}
+		ring->cq_ring_size = 0;
+	}
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+		IORING_OFF_SQ_RING);
+	if(ring->sq_ring == MAP_FAILED) {
+		ring->sq_ring = NULL;
+		uring_destroy(ring);
+		return -1;
+	}
+	ring->cq_ring = ring->sq_ring;
+	if(ring->cq_ring_size > 0) {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+			IORING_OFF_CQ_RING);
+		if(ring->cq_ring == MAP_FAILED) {
+			ring->cq_ring = NULL;
+			uring_destroy(ring);
+			return -1;
+		}
+	}
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+		IORING_OFF_SQES);
+	if(ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		uring_destroy(ring);
+		return -1;
+	}
+
+	char* sq = ring->sq_ring;
+	ring->sq_head = (unsigned*) (sq + params.sq_off.head);
+	ring->sq_tail = (unsigned*) (sq + params.sq_off.tail);
+	ring->sq_mask = *(unsigned*) (sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*) (sq + params.sq_off.array);
+
+	char* cq = ring->cq_ring;
+	ring->cq_head = (unsigned*) (cq + params.cq_off.head);
+	ring->cq_tail = (unsigned*) (cq + params.cq_off.tail);
+	ring->cq_mask = *(unsigned*) (cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+	return 0;
+}
+
+/**
+ * Releases an io_uring instance, requests still in flight are cancelled
+ * @param ring	The ring
+ */
+void uring_destroy(Uring* ring) {
+	if(ring->sqes != NULL) {
+		munmap(ring->sqes, ring->sqes_size);
+	}
+	if(ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring) {
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+	if(ring->sq_ring != NULL) {
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	}
+	if(ring->fd >= 0) {
+		close(ring->fd);
+	}
+	memset(ring, 0, sizeof(Uring));
+	ring->fd = -1;
+}
+
+/**
+ * Registers buffers with the kernel, so that fixed reads and writes from them
+ * skip mapping the user pages on every request
+ * @param ring		The ring
+ * @param bufs		The buffers
+ * @param num_bufs	The no. of buffers, referred to by their index
+ *
+ * @return 0 on success, -1 on failure
+ */
+int uring_register_buffers(Uring* ring, const struct iovec* bufs, unsigned num_bufs) {
+	return syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, bufs, num_bufs) < 0 ? -1 : 0;
+}
+
+/**
+ * Takes the next free entry of the submission queue, to be filled in by the
+ * caller and sent by the next uring_submit()
+ * @param ring	The ring
+ *
+ * @return The cleared entry, NULL if the submission queue is full
+ */
+struct io_uring_sqe* uring_get_sqe(Uring* ring) {
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	unsigned tail = *ring->sq_tail + ring->to_submit;
+	if(tail - head > ring->sq_mask) {
+		return NULL;
+	}
+	unsigned index = tail & ring->sq_mask;
+	struct io_uring_sqe* sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	ring->sq_array[index] = index;
+	ring->to_submit++;
+	return sqe;
+}
+
+/**
+ * Submits the prepared requests and waits for completions
+ * @param ring		The ring
+ * @param wait_nr	The no. of completions to wait for, 0 to return right away
+ *
+ * @return 0 on success, -1 on failure
+ */
+int uring_submit(Uring* ring, unsigned wait_nr) {
+	unsigned to_submit = ring->to_submit;
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + to_submit, __ATOMIC_RELEASE);
+	ring->to_submit = 0;
+	for(;;) {
+		int status = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr,
+			wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if(status >= 0) {
+			return 0;
+		}
+		if(errno != EINTR) {
+			return -1;
+		}
+		/* the kernel never consumes an entry twice, so just enter again */
+	}
+}
+
+/**
+ * Takes the next completion from the completion queue, without waiting
+ * @param ring	The ring
+ * @param cqe	Output, the completion
+ *
+ * @return 1 if a completion was taken, 0 if there is none
+ */
+int uring_peek_cqe(Uring* ring, struct io_uring_cqe* cqe) {
+	unsigned head = *ring->cq_head;
+	if(head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+	*cqe = ring->cqes[head & ring->cq_mask];
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
@@ -0,0 +1,46 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/*
+ * An io_uring instance driven through the raw system calls. Requests are
+ * prepared in the submission queue shared with the kernel and submitted in
+ * batches, their results are read from the shared completion queue without
+ * any system call.
+ */
+typedef struct uring {
+	int fd;
+
+	/* submission queue */
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned sq_mask;
+	unsigned* sq_array;
+	struct io_uring_sqe* sqes;
+	unsigned to_submit; /* prepared since the last submission */
+
+	/* completion queue */
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe* cqes;
+
+	/* mappings of the rings */
+	void* sq_ring;
+	size_t sq_ring_size;
+	void* cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+} Uring;
+
+int uring_init(Uring* ring, unsigned entries);
+void uring_destroy(Uring* ring);
+int uring_register_buffers(Uring* ring, const struct iovec* bufs, unsigned num_bufs);
+struct io_uring_sqe* uring_get_sqe(Uring* ring);
+int uring_submit(Uring* ring, unsigned wait_nr);
+int uring_peek_cqe(Uring* ring, struct io_uring_cqe* cqe);
+
+#endif
@@ -0,0 +1,447 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "writer.h"
+
+/**
+ * Writes a buffer to a file at an offset, completing short writes
+ * @param w			The writer
+ * @param data		The buffer
+ * @param len		The no. of bytes to write
+ * @param offset	The file offset
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int write_fully(Writer* w, const char* data, size_t len, uint64_t offset) {
+	while(len > 0) {
+		ssize_t status = pwrite(w->fd, data, len, offset);
+		w->write_calls++;
+		if(status < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		data += status;
+		len -= status;
+		offset += status;
+	}
+	return 0;
+}
+
+/**
+ * Writes the extents of a chunk synchronously and empties it
+ * @param w	The writer
+ * @param c	The chunk
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int write_extents(Writer* w, WriteChunk* c) {
+	int status = 0;
+	for(int i = 0; i < c->num_extents && status == 0; i++) {
+		WriteExtent* e = &c->extents[i];
+		status = write_fully(w, c->data + e->start, e->len, e->offset);
+	}
+	c->len = 0;
+	c->num_extents = 0;
+	return status;
+}
+
+/**
+ * Records the completion of an extent written through io_uring
+ * @param w		The writer
+ * @param cqe	The completion of the write request
+ */
+static void complete_chunk(Writer* w, struct io_uring_cqe* cqe) {
+	WriteChunk* c = &w->chunks[cqe->user_data / WRITE_EXTENTS];
+	WriteExtent* e = &c->extents[cqe->user_data % WRITE_EXTENTS];
+	if(cqe->res < 0) {
+		if(w->error == 0) {
+			w->error = -cqe->res;
+		}
+	} else if((uint32_t) cqe->res < e->len) {
+		/* finish a short write synchronously */
+		if(write_fully(w, c->data + e->start + cqe->res, e->len - cqe->res, e->offset + cqe->res) < 0 &&
+			w->error == 0) {
+			w->error = errno;
+		}
+	}
+	if(--c->pending == 0) {
+		c->is_busy = 0;
+		c->len = 0;
+		c->num_extents = 0;
+	}
+}
+
+/**
+ * Body of the writer thread, writes the queued chunks in order until the
+ * writer is destroyed
+ * @param arg	The writer
+ */
+static void* write_behind(void* arg) {
+	Writer* w = arg;
+	pthread_mutex_lock(&w->lock);
+	for(;;) {
+		while(w->queue_len == 0 && !w->is_stopping) {
+			pthread_cond_wait(&w->submitted, &w->lock);
+		}
+		if(w->queue_len == 0) {
+			break;
+		}
+		WriteChunk* c = &w->chunks[w->queue[w->queue_head]];
+		pthread_mutex_unlock(&w->lock);
+		int status = write_extents(w, c);
+		int error = errno;
+
+		pthread_mutex_lock(&w->lock);
+		if(status < 0 && w->thread_error == 0) {
+			w->thread_error = error;
+		}
+		w->queue_head = (w->queue_head + 1) % WRITE_CHUNKS;
+		w->queue_len--;
+		c->is_busy = 0;
+		pthread_cond_broadcast(&w->completed);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+/**
+ * Waits until the write of a chunk has completed
+ * @param w	The writer
+ * @param c	The chunk
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int wait_chunk(Writer* w, WriteChunk* c) {
+	if(w->use_thread) {
+		pthread_mutex_lock(&w->lock);
+		while(c->is_busy) {
+			pthread_cond_wait(&w->completed, &w->lock);
+		}
+		if(w->thread_error != 0 && w->error == 0) {
+			w->error = w->thread_error;
+		}
+		pthread_mutex_unlock(&w->lock);
+		return 0;
+	}
+
+	struct io_uring_cqe cqe;
+	while(c->is_busy) {
+		if(uring_peek_cqe(&w->ring, &cqe)) {
+			complete_chunk(w, &cqe);
+		} else {
+			w->write_calls++;
+			if(uring_submit(&w->ring, 1) < 0) {
+				w->error = errno;
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * Writes the staged extents of a chunk to the file
+ * @param w	The writer
+ * @param c	The chunk
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int write_chunk(Writer* w, WriteChunk* c) {
+	if(w->use_thread) {
+		pthread_mutex_lock(&w->lock);
+		c->is_busy = 1;
+		w->queue[(w->queue_head + w->queue_len) % WRITE_CHUNKS] = c - w->chunks;
+		w->queue_len++;
+		pthread_cond_signal(&w->submitted);
+		pthread_mutex_unlock(&w->lock);
+		return 0;
+	}
+	if(!w->use_uring) {
+		int status = write_extents(w, c);
+		if(status < 0) {
+			w->error = errno;
+		}
+		return status;
+	}
+
+	/* the chunks are fixed buffers and there is an entry for every extent of every chunk, so one is always free */
+	for(int i = 0; i < c->num_extents; i++) {
+		WriteExtent* e = &c->extents[i];
+		struct io_uring_sqe* sqe = uring_get_sqe(&w->ring);
+		sqe->opcode = IORING_OP_WRITE_FIXED;
+		sqe->fd = w->fd;
+		sqe->addr = (uintptr_t) (c->data + e->start);
+		sqe->len = e->len;
+		sqe->off = e->offset;
+		sqe->buf_index = c - w->chunks;
+		sqe->user_data = (c - w->chunks) * WRITE_EXTENTS + i;
+	}
+	c->pending = c->num_extents;
+	c->is_busy = 1;
+	w->write_calls++;
+	if(uring_submit(&w->ring, 0) < 0) {
+		w->error = errno;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Writes the chunk being filled and moves on to the next one, once its
+ * previous write has completed
+ * @param w	The writer
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int next_chunk(Writer* w) {
+	if(write_chunk(w, &w->chunks[w->current]) < 0) {
+		return -1;
+	}
+	w->current = (w->current + 1) % WRITE_CHUNKS;
+	return wait_chunk(w, &w->chunks[w->current]);
+}
+
+/**
+ * Stages data to be written at an offset of the file
+ * @param w			The writer
+ * @param data		The data
+ * @param len		The no. of bytes
+ * @param offset	The file offset
+ *
+ * @return 0 on success, -1 if a write has failed (errno is set)
+ */
+static int stage(Writer* w, const char* data, size_t len, uint64_t offset) {
+	while(len > 0) {
+		WriteChunk* c = &w->chunks[w->current];
+		WriteExtent* e = (c->num_extents > 0) ? &c->extents[c->num_extents - 1] : NULL;
+		if(e == NULL || offset != e->offset + e->len) {
+			if(c->num_extents == WRITE_EXTENTS) {
+				/* too scattered, write what is staged first */
+				if(next_chunk(w) < 0) {
+					break;
+				}
+				continue;
+			}
+			e = &c->extents[c->num_extents++];
+			e->start = c->len;
+			e->len = 0;
+			e->offset = offset;
+		}
+		size_t n = WRITE_CHUNK_SIZE - c->len;
+		if(n > len) {
+			n = len;
+		}
+		memcpy(c->data + c->len, data, n);
+		c->len += n;
+		e->len += n;
+		data += n;
+		len -= n;
+		offset += n;
+
+		if(c->len == WRITE_CHUNK_SIZE && next_chunk(w) < 0) {
+			break;
+		}
+	}
+	if(w->error != 0) {
+		errno = w->error;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Allocates the chunks of a writer, which serve all the files it writes
+ * @param w			The writer
+ * @param use_uring	1 to write through io_uring if the kernel allows it, 0
+ * 					to write synchronously
+ *
+ * @return 0 on success, -1 on failure
+ */
+int writer_init(Writer* w, int use_uring) {
+	memset(w, 0, sizeof(Writer));
+	w->fd = -1;
+	w->ring.fd = -1;
+	for(int i = 0; i < WRITE_CHUNKS; i++) {
+		w->chunks[i].data = malloc(WRITE_CHUNK_SIZE);
+		if(w->chunks[i].data == NULL) {
+			writer_destroy(w);
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	/* fall back to synchronous writes if io_uring is disabled or too old for fixed buffers */
+	if(use_uring && uring_init(&w->ring, WRITE_CHUNKS * WRITE_EXTENTS) == 0) {
+		struct iovec bufs[WRITE_CHUNKS];
+		for(int i = 0; i < WRITE_CHUNKS; i++) {
+			bufs[i].iov_base = w->chunks[i].data;
+			bufs[i].iov_len = WRITE_CHUNK_SIZE;
+		}
+		if(uring_register_buffers(&w->ring, bufs, WRITE_CHUNKS) == 0) {
+			w->use_uring = 1;
+		} else {
+			uring_destroy(&w->ring);
+		}
+	}
+
+	/* otherwise, write behind the receiving from a thread, or synchronously if it cannot be started */
+	if(!w->use_uring && pthread_mutex_init(&w->lock, NULL) == 0) {
+		pthread_cond_init(&w->submitted, NULL);
+		pthread_cond_init(&w->completed, NULL);
+		if(pthread_create(&w->thread, NULL, write_behind, w) == 0) {
+			w->use_thread = 1;
+		} else {
+			pthread_cond_destroy(&w->submitted);
+			pthread_cond_destroy(&w->completed);
+			pthread_mutex_destroy(&w->lock);
+		}
+	}
+	return 0;
+}
+
+/**
+ * Opens an output file to be written next, the previous one must have been
+ * closed. A file written from the start is created or truncated, a resumed
+ * one keeps its contents up to the offset.
+ * @param w			The writer
+ * @param path		The path of the file
+ * @param mode		The permission bits of a created file, before the umask
+ * @param offset	The offset writing starts at, 0 for a new file
+ *
+ * @return 0 on success, -1 on failure
+ */
+int writer_open(Writer* w, const char* path, mode_t mode, uint64_t offset) {
+	w->fd = open(path, O_WRONLY | O_CREAT | (offset == 0 ? O_TRUNC : 0), mode);
+	if(w->fd < 0) {
+		return -1;
+	}
+	w->offset = offset;
+	w->current = 0;
+	w->error = 0;
+	w->thread_error = 0; /* the thread is idle, every chunk of the previous file has been waited for */
+	return 0;
+}
+
+/**
+ * Reserves the disk space of the whole file up front and sets its size, so
+ * that writes at any offset neither fail for lack of space nor fragment it
+ * @param w		The writer
+ * @param size	The size of the file
+ *
+ * @return 0 on success, -1 on failure
+ */
+int writer_preallocate(Writer* w, uint64_t size) {
+	if(size == 0) {
+		return 0;
+	}
+	int status = posix_fallocate(w->fd, 0, size);
+	if(status == EINVAL || status == EOPNOTSUPP) {
+		/* the file system cannot reserve space, at least set the size */
+		status = (ftruncate(w->fd, size) < 0) ? errno : 0;
+	}
+	if(status != 0) {
+		errno = w->error = status;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Writes data at an offset of the file. It is staged like appended data, and
+ * written with the packets following it.
+ * @param w			The writer
+ * @param data		The data
+ * @param len		The no. of bytes
+ * @param offset	The file offset
+ *
+ * @return 0 on success, -1 if a write has failed (errno is set)
+ */
+int writer_write_at(Writer* w, const char* data, size_t len, uint64_t offset) {
+	return stage(w, data, len, offset);
+}
+
+/**
+ * Appends data to the file. A chunk is written once it is full, and the next
+ * one must have finished its previous write before being filled.
+ * @param w		The writer
+ * @param data	The data
+ * @param len	The no. of bytes
+ *
+ * @return 0 on success, -1 if a write has failed (errno is set)
+ */
+int writer_append(Writer* w, const char* data, size_t len) {
+	uint64_t offset = w->offset;
+	w->offset += len;
+	return stage(w, data, len, offset);
+}
+
+/**
+ * Writes everything appended so far and waits for all the writes to complete
+ * @param w	The writer
+ *
+ * @return 0 on success, -1 if a write has failed (errno is set)
+ */
+int writer_flush(Writer* w) {
+	WriteChunk* c = &w->chunks[w->current];
+	if(c->len > 0 && write_chunk(w, c) == 0) {
+		w->current = (w->current + 1) % WRITE_CHUNKS;
+	}
+	for(int i = 0; i < WRITE_CHUNKS; i++) {
+		wait_chunk(w, &w->chunks[i]);
+	}
+	if(w->error != 0) {
+		errno = w->error;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Flushes and closes the output file, the chunks are kept for the next one
+ * @param w	The writer
+ *
+ * @return 0 on success, -1 if a write has failed (errno is set)
+ */
+int writer_close(Writer* w) {
+	if(w->fd < 0) {
+		return 0;
+	}
+	int status = writer_flush(w);
+	if(close(w->fd) < 0 && status == 0) {
+		status = -1;
+	}
+	w->fd = -1;
+	return status;
+}
+
+/**
+ * Closes the output file if still open and releases the writer
+ * @param w	The writer
+ */
+void writer_destroy(Writer* w) {
+	writer_close(w);
+	if(w->use_uring) {
+		uring_destroy(&w->ring);
+		w->use_uring = 0;
+	}
+	if(w->use_thread) {
+		pthread_mutex_lock(&w->lock);
+		w->is_stopping = 1;
+		pthread_cond_signal(&w->submitted);
+		pthread_mutex_unlock(&w->lock);
+		pthread_join(w->thread, NULL);
+		pthread_cond_destroy(&w->submitted);
+		pthread_cond_destroy(&w->completed);
+		pthread_mutex_destroy(&w->lock);
+		w->use_thread = 0;
+	}
+	for(int i = 0; i < WRITE_CHUNKS; i++) {
+		free(w->chunks[i].data);
+		w->chunks[i].data = NULL;
+	}
+}
@@ -0,0 +1,78 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "uring.h"
+
+#define WRITE_CHUNK_SIZE (256 * 1024) /* bytes written to the file per request */
+#define WRITE_CHUNKS 4 /* chunks being filled or written at the same time */
+#define WRITE_EXTENTS 64 /* separate runs of data a chunk can stage */
+
+/* A run of data staged in a chunk, to be written to a contiguous part of the file */
+typedef struct write_extent {
+	uint32_t start; /* position in the data of the chunk */
+	uint32_t len;
+	uint64_t offset; /* in the file */
+} WriteExtent;
+
+/* Parts of the file staged in memory */
+typedef struct write_chunk {
+	char* data; /* WRITE_CHUNK_SIZE bytes */
+	size_t len; /* bytes staged */
+	WriteExtent extents[WRITE_EXTENTS];
+	int num_extents;
+	int pending; /* io_uring requests not completed yet */
+	int is_busy; /* being written by the kernel or the writer thread */
+} WriteChunk;
+
+/*
+ * Sequential writer of output files, one at a time. Data is staged in chunks and every
+ * full chunk is written in one request. With io_uring the request is only
+ * submitted and the next chunk is filled meanwhile, so receiving and writing
+ * to disk overlap. Otherwise, or if io_uring is not available, the chunks are
+ * queued to a writer thread of their own, to the same effect. Only if the
+ * thread cannot be started is every chunk written synchronously.
+ *
+ * Alternatively, packets can be written at their offsets in a preallocated
+ * file, in any order. They are staged the same way, a packet that does not
+ * follow the previous one starting an extent of its own, and every extent
+ * is written in one request. Appending and positional writes must not be
+ * mixed on one file.
+ */
+typedef struct writer {
+	int fd; /* of the file being written, -1 if none */
+	uint64_t offset; /* file offset of the next appended byte */
+	WriteChunk chunks[WRITE_CHUNKS];
+	int current; /* chunk being filled */
+	int use_uring;
+	Uring ring; /* chunks are registered as its fixed buffers */
+	int error; /* errno of the first failed write, 0 if none */
+
+	/* write-behind thread, when io_uring is not used */
+	int use_thread;
+	pthread_t thread;
+	pthread_mutex_t lock; /* guards the fields below and the is_busy flags */
+	pthread_cond_t submitted; /* a chunk was queued, or the thread is to stop */
+	pthread_cond_t completed; /* a chunk was written */
+	int queue[WRITE_CHUNKS]; /* indexes of the chunks to be written, in order */
+	int queue_head;
+	int queue_len;
+	int is_stopping;
+	int thread_error; /* errno of the first write the thread failed */
+	unsigned long write_calls; /* system calls made for writing */
+} Writer;
+
+int writer_init(Writer* w, int use_uring);
+int writer_open(Writer* w, const char* path, mode_t mode, uint64_t offset);
+int writer_preallocate(Writer* w, uint64_t size);
+int writer_append(Writer* w, const char* data, size_t len);
+int writer_write_at(Writer* w, const char* data, size_t len, uint64_t offset);
+int writer_flush(Writer* w);
+int writer_close(Writer* w);
+void writer_destroy(Writer* w);
+
+#endif